@@ -1,11 +1,34 @@
 #ifndef CLI_H
 #define CLI_H
 
+#include "palette.h"
 #include "prgsem_main.h"
 
+#define CLI_EXTRA_FRAMES_IN_FLIGHT 2 // Default frames in flight over CPUs
+#define CLI_BAND_ROWS 16             // Rows rendered per task of a still image
+#define AA_PATTERNS 5
+#define AA_SAMPLES_MAX 16
+
+// Antialiasing samples of a pixel, offsets in pixels from where it is
+// sampled without antialiasing. Only pixels whose iterations differ from a
+// neighbour's get them, the colours of the samples are averaged.
+typedef struct {
+  const char *name;
+  int count; // 0 = no antialiasing
+  float offsets[AA_SAMPLES_MAX][2];
+} aa_pattern;
+
+extern const aa_pattern aa_patterns[AA_PATTERNS];
+
 bool save_image_auto(const char *path, uint8_t *image, int w, int h);
+// aa may be NULL
 void render_image(
     uint8_t *image, int w, int h, double c_re, double c_i, double re_min,
+    double re_max, double im_min, double im_max, uint8_t max_iter,
+    const palette *pal, const aa_pattern *aa
+);
+void render_grid(
+    uint8_t *grid, int w, int h, double c_re, double c_im, double re_min,
     double re_max, double im_min, double im_max, uint8_t max_iter
 );
 int cli_main(app_state *state, struct arguments *args);
@@ -26,8 +26,11 @@ typedef enum {
 
 typedef void (*event_pusher_fn)(event);
 
+struct iovec;
+
 void assertion(bool r, const char *fcname, int line, const char *fname);
 void *safe_alloc(size_t size);
+bool write_all(int fd, struct iovec *iov, int cnt);
 
 void set_log_level(log_level_t level);
 void log_msg(log_level_t level, const char *level_str, const char *fmt, ...);
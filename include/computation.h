@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <stdbool.h>
 
 #include "messages.h"
@@ -6,8 +7,20 @@
 #define __COMPUTATION_H__
 
 #define CHUNK_SIZE_FACTOR 10 // Chunk size is width or height / this
+#define DIRTY_RECTS_MAX 16   // More changed regions fall back to a full redraw
+#define KNOWN_EXACT 1        // known[]: grid holds the value for this view and n
+#define KNOWN_ORBIT 2        // known[]: orbit holds z after grid[] iterations
 #define APP_DOCSTRING "Fractal computation viewer"
 
+typedef struct {
+  int x, y; // Top-left corner in pixels
+  int w, h; // Size in pixels
+} grid_rect;
+
+typedef struct {
+  double re, im;
+} orbit_z;
+
 typedef struct {
   double c_re; // Real part of complex constant c
   double c_im; // Imaginary part of complex constant c
@@ -40,12 +53,42 @@ typedef struct {
   uint8_t chunk_n_im; // Height of one chunk in pixels on the imaginary axis
 
   uint8_t *grid;
+  uint8_t *known;  // KNOWN_* flags of every grid cell
+  orbit_z *orbit;  // Last z of locally computed pixels that did not escape
+  size_t grid_len; // Number of allocated grid (and known, orbit) cells
+
+  grid_rect dirty[DIRTY_RECTS_MAX]; // Grid regions changed since last snapshot
+  int nbr_dirty;                    // Number of dirty regions, -1 = whole grid
 
   bool computing, abort, done;
+  unsigned gen; // Bumped whenever the view, size or n changes, the low byte
+                // tags the messages exchanged with the module
+
+  pthread_mutex_t mtx; // Guards chunk state and grid against the pipe thread
 } comp_ctx;
 
+// Private copy of the view for computing off the main thread
+typedef struct {
+  unsigned gen; // ctx->gen the copy was taken at
+  int w, h, n;
+  double c_re, c_im;
+  double re_min, im_max; // Coordinates of the top-left pixel
+  double d_re, d_im;
+  uint8_t *grid, *known;
+  orbit_z *orbit;
+  size_t len; // Number of allocated cells
+} local_job;
+
 comp_ctx *computation_create(void);
 void ctx_update(comp_ctx *ctx);
+void set_grid_size(comp_ctx *ctx, int w, int h);
+void set_view(
+    comp_ctx *ctx, double re_min, double re_max, double im_min, double im_max
+);
+void rescale_grid(
+    comp_ctx *ctx, int w, int h, int num, int den, int off_x, int off_y
+);
+void set_iterations(comp_ctx *ctx, int n);
 void computation_destroy(comp_ctx *ctx);
 
 bool is_computing(comp_ctx *ctx);
@@ -56,11 +99,25 @@ void get_grid_size(comp_ctx *ctx, int *w, int *h);
 void abort_comp(comp_ctx *ctx);
 bool set_compute(comp_ctx *ctx, message *msg);
 bool compute(comp_ctx *ctx, message *msg);
-void update_image(comp_ctx *ctx, int w, int h, unsigned char *img);
+int snapshot_grid(
+    comp_ctx *ctx, uint8_t **front, size_t *front_size, int *w, int *h, int *n,
+    grid_rect *rects
+);
+void mark_grid_dirty(comp_ctx *ctx);
+void set_grid_known(comp_ctx *ctx);
 void update_data(comp_ctx *ctx, const msg_compute_data *data);
 void clear_grid(comp_ctx *ctx);
+void shift_grid(comp_ctx *ctx, int dx, int dy);
 int get_current_cid(comp_ctx *ctx);
 void reset_cid(comp_ctx *ctx);
 uint8_t *get_internal_grid(comp_ctx *ctx);
 
+void local_job_snapshot(comp_ctx *ctx, local_job *job);
+bool local_job_is_current(comp_ctx *ctx, const local_job *job);
+bool local_job_publish(comp_ctx *ctx, const local_job *job);
+void local_job_free(local_job *job);
+uint8_t iterate_orbit(
+    double c_re, double c_im, orbit_z *z, uint8_t k, uint8_t max_iter
+);
+
 #endif
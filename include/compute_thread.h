@@ -0,0 +1,12 @@
+#ifndef __COMPUTE_THREAD_H__
+#define __COMPUTE_THREAD_H__
+
+#include "common.h"
+
+#define COMPUTE_WAIT_TIMEOUT_MS 100
+#define PREVIEW_MAX_STEP 8 // Pixel step of the coarsest pass (power of two)
+
+void compute_request_local(void);
+void *compute_thread(void *arg);
+
+#endif
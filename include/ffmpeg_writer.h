@@ -3,11 +3,24 @@
 
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <stdbool.h>
 #include <stdint.h>
 
-#define VIDEO_BITRATE 10 * 1000 * 1000; // 10 Mbps
-#define VIDEO_CFR "18"                  // 0 = lossless, 18 = visually lossless
-#define VIDEO_CODEC AV_CODEC_ID_H264
+#include "palette.h"
+
+#define VIDEO_BITRATE 10 * 1000 * 1000 // 10 Mbps, for encoders without CRF
+#define VIDEO_CFR 18                   // 0 = lossless, 18 = visually lossless
+#define VIDEO_CODEC "libx264"
+
+// Encoder settings, ffv1 (lossless) keeps full chroma resolution
+typedef struct {
+  const char *codec;  // Encoder name, NULL for VIDEO_CODEC
+  const char *preset; // Speed preset of the encoder, NULL for its default
+  int crf;            // Constant rate factor, < 0 for VIDEO_CFR
+  int threads;        // Encoder threads, 0 = one per CPU
+  int thread_type;    // FF_THREAD_FRAME | FF_THREAD_SLICE, 0 = both
+  int gop;            // Frames per closed GOP, 0 = left to the encoder
+} ffmpeg_profile;
 
 typedef struct {
   AVFormatContext *fmt_ctx;
@@ -19,11 +32,24 @@ typedef struct {
   int width, height;
 } ffmpeg_writer;
 
-ffmpeg_writer *
-ffmpeg_writer_create(const char *filename, int width, int height, int fps);
+// The container is picked from the file extension
+ffmpeg_writer *ffmpeg_writer_create(
+    const char *filename, int width, int height, int fps,
+    const ffmpeg_profile *profile
+);
 void ffmpeg_writer_add_frame(ffmpeg_writer *writer, uint8_t *rgb_data);
+void ffmpeg_writer_add_grid(
+    ffmpeg_writer *writer, const uint8_t *grid, const palette *pal
+);
 
 // Close writer and save video
 void ffmpeg_writer_close(ffmpeg_writer *writer);
 
+// Joins the video streams of segment files encoded alike (e.g. rendered
+// with --frame-range) one after the other into filename, packets are copied
+// without re-encoding
+bool ffmpeg_concat(
+    const char *filename, char *const *segments, int nbr_segments
+);
+
 #endif
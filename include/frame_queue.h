@@ -0,0 +1,37 @@
+#ifndef __FRAME_QUEUE_H__
+#define __FRAME_QUEUE_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Reorder buffer between any number of producers (renderers) and one
+// consumer (encoder). Producers take a pooled buffer together with the next
+// frame index, frames may be submitted out of order and are popped in index
+// order. At most depth frames are in flight, which also bounds memory.
+typedef struct {
+  uint8_t **pool;  // depth frame buffers
+  uint8_t **free;  // Stack of buffers ready for reuse
+  uint8_t **ready; // Submitted frames, slot index % depth
+  int depth, nbr_free;
+  int nbr_frames; // Frame indices handed out are below this
+  int next_index; // Next frame index to hand out
+  int next_pop;   // Next frame index the consumer gets
+  bool closed;    // No more frame indices will be handed out
+  pthread_mutex_t mtx;
+  pthread_cond_t cond;
+} frame_queue;
+
+frame_queue *frame_queue_create(size_t frame_size, int depth, int nbr_frames);
+void frame_queue_destroy(frame_queue *fq);
+
+uint8_t *frame_queue_acquire(frame_queue *fq, int *index);
+void frame_queue_submit(frame_queue *fq, uint8_t *frame, int index);
+void frame_queue_close(frame_queue *fq);
+void frame_queue_stop_at(frame_queue *fq, int align);
+
+uint8_t *frame_queue_pop(frame_queue *fq);
+void frame_queue_release(frame_queue *fq, uint8_t *frame);
+
+#endif
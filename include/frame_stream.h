@@ -0,0 +1,42 @@
+#ifndef __FRAME_STREAM_H__
+#define __FRAME_STREAM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "palette.h"
+
+#define FRAME_STREAM_STDOUT "-" // Output path that streams to stdout
+
+typedef enum {
+  FRAME_STREAM_NONE, // Encode with libavcodec instead
+  FRAME_STREAM_Y4M,  // YUV4MPEG2, 4:2:0 limited range like the encoded videos
+  FRAME_STREAM_RGB   // Raw RGB frames back to back, no header
+} frame_stream_format;
+
+// Animation frames written uncompressed to stdout, a FIFO or a file for an
+// external encoder. Writes block while the reader is behind, which stalls
+// the renderer once its frames in flight are used up.
+typedef struct {
+  int fd;
+  bool close_fd; // false for stdout
+  frame_stream_format format;
+  int w, h;
+  char header[96]; // Sent along with the first frame
+  size_t header_len;
+  uint8_t *buf; // One frame converted to the output format
+  size_t frame_size;
+} frame_stream;
+
+frame_stream *frame_stream_create(
+    const char *path, int w, int h, int fps, frame_stream_format format
+);
+// Both fail once the reader has gone away
+bool frame_stream_add_grid(
+    frame_stream *s, const uint8_t *grid, const palette *pal
+);
+bool frame_stream_add_frame(frame_stream *s, const uint8_t *rgb);
+bool frame_stream_close(frame_stream *s);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __GRID_FILE_H__
+#define __GRID_FILE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GRID_FILE_MAGIC "PRGGRID"
+#define GRID_FILE_VERSION 2
+#define GRID_FILE_TILE 64          // Tile side, a tile fills one 4 KiB page
+#define GRID_FILE_DATA_OFFSET 4096 // Header padded so that tiles are aligned
+
+// Header of a .grid file: iteration counts (0..n), one byte each, from
+// header_size on. They are stored in tile_w*tile_h tiles, tiles row by row
+// and each tile row by row, edge tiles padded to full size with zeros.
+// Version 1 files have no tile fields and are a single w*h tile. Fields are
+// in host byte order, the layout has no padding.
+typedef struct {
+  char magic[8];        // GRID_FILE_MAGIC with its terminating zero
+  uint32_t version;     // GRID_FILE_VERSION
+  uint32_t header_size; // Where the data starts
+  uint32_t w, h;
+  uint32_t n;        // Iteration limit the grid was computed with
+  uint32_t reserved; // 0
+  double c_re, c_im;
+  double re_min, re_max;
+  double im_min, im_max;
+  uint32_t tile_w, tile_h; // Since version 2
+} grid_file_header;
+
+// A grid file mapped into memory read-only
+typedef struct {
+  grid_file_header header; // Version 1 files get tile_w = w, tile_h = h
+  const uint8_t *data;     // First tile
+  void *map;
+  size_t map_size;
+} grid_file;
+
+grid_file *grid_file_open(const char *path);
+void grid_file_close(grid_file *g);
+// Copies the grid into a w*h raster
+void grid_file_read(const grid_file *g, uint8_t *dst);
+// Same for count rows from y0 on
+void grid_file_read_rows(const grid_file *g, int y0, int count, uint8_t *dst);
+
+// Rearranges count (<= tile_h) full-width rows into the tiles of one tile
+// row, returns its size in bytes
+size_t grid_file_tile_rows(
+    const grid_file_header *header, const uint8_t *rows, int count,
+    uint8_t *tiles
+);
+
+#endif
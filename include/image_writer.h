@@ -1,6 +1,33 @@
 #ifndef __IMAGE_WRITER_H__
 #define __IMAGE_WRITER_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "grid_file.h"
+#include "png_writer.h"
+
+#define IMAGE_FORMATS ".png, .jpg, .ppm, .pam, .qoi, .rgb or .grid"
+
+// Image file written top to bottom a few rows at a time, so that the whole
+// image never has to be in memory. The format follows the extension: PNG,
+// JPEG, the uncompressed PPM, PAM and raw RGB (no header), or QOI.
+typedef struct image_stream image_stream;
+
+// png may be NULL for the default compression
+image_stream *
+image_stream_open(const char *path, int w, int h, const png_options *png);
+// Iterations tiled as header describes, rows are header->w bytes instead of
+// RGB. The header is padded to header->header_size.
+image_stream *
+grid_stream_open(const char *path, const grid_file_header *header);
+bool image_stream_write(image_stream *s, const uint8_t *rows, int count);
+// Fails if not all rows were written, the file is then incomplete
+bool image_stream_close(image_stream *s);
+
+// Whether path names a .grid file, which takes iterations instead of RGB
+bool image_path_is_grid(const char *path);
+
 bool save_image_png(const char *path, uint8_t *image, int w, int h);
 bool save_image_jpg(const char *path, uint8_t *image, int w, int h);
 
@@ -0,0 +1,49 @@
+#ifndef __KEYFRAME_ZOOM_H__
+#define __KEYFRAME_ZOOM_H__
+
+#include <stdint.h>
+
+#include "palette.h"
+
+#define KEYFRAME_SCALE 2           // Keyframe size relative to the frame
+#define KEYFRAME_FADE 0.5          // Part of a keyframe interval cross-faded
+#define KEYFRAMES_PER_OCTAVE_MAX 8 // Upper bound of the quality knob
+
+// Zoom animation frames resampled from supersampled keyframes. A level is
+// log2 of a view span relative to the start view, keyframe k has level
+// level_max - k / per_octave and every frame with a level below it is a crop
+// of it.
+typedef struct {
+  int w, h;       // Frame size, keyframes are KEYFRAME_SCALE times larger
+  int per_octave; // Keyframes per zoom doubling
+  int count;
+  double level_max;
+  double re_center, im_center;
+  double re_span, im_span; // Start view
+  uint8_t **grids;         // Iterations of each keyframe, NULL if not held
+} keyframe_zoom;
+
+int keyframe_zoom_count(double zoom, int per_octave);
+keyframe_zoom *keyframe_zoom_create(
+    int w, int h, double re_min, double re_max, double im_min, double im_max,
+    double zoom, int per_octave
+);
+void keyframe_zoom_destroy(keyframe_zoom *kz);
+// Keyframes are allocated only while frames are cut out of them
+void keyframe_zoom_alloc(keyframe_zoom *kz, int k);
+void keyframe_zoom_free(keyframe_zoom *kz, int k);
+
+void keyframe_zoom_bounds(
+    const keyframe_zoom *kz, int k, double *re_min, double *re_max,
+    double *im_min, double *im_max
+);
+// The one or two keyframes the frame at level is cut out of and their
+// weights, returns how many
+int keyframe_zoom_keys(
+    const keyframe_zoom *kz, double level, int *keys, float *weights
+);
+void keyframe_zoom_frame(
+    const keyframe_zoom *kz, double level, const palette *pal, uint8_t *rgb
+);
+
+#endif
@@ -43,6 +43,7 @@ typedef struct {
   double d_re; // increment in the x-coords
   double d_im; // increment in the y-coords
   uint8_t n;   // number of iterations per each pixel
+  uint8_t gen; // view generation the parameters belong to
 } msg_set_compute;
 
 typedef struct {
@@ -51,6 +52,7 @@ typedef struct {
   double im;    // start of the y-coords (imaginary)
   uint8_t n_re; // number of cells in x-coords
   uint8_t n_im; // number of cells in y-coords
+  uint8_t gen;  // view generation, echoed back in the computed data
 } msg_compute;
 
 typedef struct {
@@ -58,6 +60,7 @@ typedef struct {
   uint8_t i_re; // x-coords
   uint8_t i_im; // y-coords
   uint8_t iter; // result
+  uint8_t gen;  // view generation of the chunk
 } msg_compute_data;
 
 typedef struct {
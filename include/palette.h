@@ -0,0 +1,49 @@
+#ifndef __PALETTE_H__
+#define __PALETTE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PALETTE_SIZE 256    // One entry per possible uint8_t iteration value
+#define PALETTE_GRADIENTS 3 // Built-in gradients, the default first
+
+// Maps t = iter / (n + 1) in [0, 1] to a colour
+typedef void (*palette_gradient_fn)(double t, uint8_t *rgb);
+
+typedef struct {
+  const char *name;
+  palette_gradient_fn fn;
+} palette_gradient_info;
+
+typedef struct {
+  int n; // Iteration limit the table was built for, -1 if not built yet
+  unsigned version; // Bumped on every rebuild, lets users cache derived tables
+  palette_gradient_fn gradient;
+  uint8_t rgb[PALETTE_SIZE][3];
+  uint32_t packed[PALETTE_SIZE]; // Same colours as 0x00BBGGRR (SIMD gather)
+  uint8_t yuv[PALETTE_SIZE][3];  // Same colours as BT.601 limited range YCbCr
+} palette;
+
+void palette_gradient_default(double t, uint8_t *rgb);
+extern const palette_gradient_info palette_gradients[PALETTE_GRADIENTS];
+
+void palette_init(palette *p, palette_gradient_fn gradient);
+bool palette_update(palette *p, int n);
+void palette_set_gradient(palette *p, palette_gradient_fn gradient);
+void palette_apply(
+    const palette *p, const uint8_t *iters, size_t count, uint8_t *rgb
+);
+void palette_apply_packed(
+    const uint32_t *lut, const uint8_t *iters, size_t count, uint32_t *dst
+);
+void palette_apply_yuv420(
+    const palette *p, const uint8_t *grid, int w, int h,
+    uint8_t *const *planes, const int *linesize
+);
+void rgb_to_yuv420(
+    const uint8_t *rgb, int w, int h, uint8_t *const *planes,
+    const int *linesize
+);
+
+#endif
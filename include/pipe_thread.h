@@ -3,7 +3,11 @@
 
 #include "common.h"
 
+// Consumer of MSG_COMPUTE_DATA called on the pipe thread itself
+typedef void (*compute_data_fn)(void *arg, const msg_compute_data *data);
+
 void pipe_set_event_pusher(event_pusher_fn handler);
+void pipe_set_compute_data_handler(compute_data_fn handler, void *arg);
 void pipe_set_input_pipe_fd(int fd);
 void *pipe_thread(void *arg);
 
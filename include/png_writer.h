@@ -0,0 +1,90 @@
+#ifndef __PNG_WRITER_H__
+#define __PNG_WRITER_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PNG_LEVEL_DEFAULT 6       // zlib level, as libpng uses
+#define PNG_GROUP_BYTES (1 << 20) // Raw bytes per independently deflated group
+#define PNG_GROUPS_PER_THREAD 2   // Groups in flight per worker thread
+
+typedef enum {
+  PNG_ROW_FILTER_ADAPTIVE, // Per row the one with the smallest output
+  PNG_ROW_FILTER_NONE,     // The others are PNG filter types 0-4, plus one
+  PNG_ROW_FILTER_SUB,
+  PNG_ROW_FILTER_UP,
+  PNG_ROW_FILTER_AVERAGE,
+  PNG_ROW_FILTER_PAETH
+} png_row_filter;
+
+// Rows of one group and what a worker made of them
+typedef struct {
+  uint8_t *rows; // The row above the group (zeros at the top), then its rows
+  uint8_t *filtered;
+  uint8_t *out; // Raw deflate data, sync flushed so that groups concatenate
+  size_t out_len, out_cap;
+  size_t rows_cap, filtered_cap; // Allocated, kept for the next file
+  int nbr_rows;
+  bool first, last;
+  bool queued, done, failed;
+  uint32_t adler; // Of the filtered rows
+} png_group;
+
+typedef struct png_writer png_writer;
+
+// Worker threads and group buffers of PNG writers, which use them one at a
+// time. The images of a batch share one instead of each starting its own.
+typedef struct {
+  png_group *groups; // Group i of the writer is in slot i % depth
+  int depth;
+  pthread_t *threads;
+  int nbr_threads; // Wanted, started with the first writer
+  int nbr_started;
+  int nbr_busy;   // Workers deflating a group
+  png_writer *pw; // Writer the workers take groups of, NULL between files
+  bool quit;
+  pthread_mutex_t mtx;
+  pthread_cond_t cond;
+} png_pool;
+
+typedef struct {
+  int level; // zlib level 0-9, < 0 for PNG_LEVEL_DEFAULT
+  png_row_filter filter;
+  int threads;    // 0 = one per CPU, without pool
+  png_pool *pool; // NULL = the writer has its own
+} png_options;
+
+// RGB PNG writer that filters and deflates groups of rows on worker threads
+// and writes them in order as one zlib stream (as pigz does), rows are added
+// top to bottom.
+struct png_writer {
+  FILE *fp;
+  int w, h, level;
+  png_row_filter filter;
+  int group_rows, depth;
+  png_group *groups; // The pool's
+  int nbr_rows;      // Rows added so far
+  int next_fill;     // Group rows are added to
+  int next_job;      // Next group a worker takes
+  int nbr_queued;    // Groups below this are ready for the workers
+  int next_write;    // Next group written to the file
+  uint32_t adler;    // Of all groups written so far
+  bool failed;
+  png_pool *pool;
+  bool own_pool; // Created for this writer, destroyed with it
+};
+
+// threads 0 = one per CPU, nothing is started until a writer needs them
+png_pool *png_pool_create(int threads);
+// No writer may be using the pool any more
+void png_pool_destroy(png_pool *pool);
+
+png_writer *png_writer_create(FILE *fp, int w, int h, const png_options *opt);
+bool png_writer_add_rows(png_writer *pw, const uint8_t *rows, int count);
+// Finishes the file if all rows were added, frees the writer in any case
+bool png_writer_close(png_writer *pw);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "computation.h"
 #include "event_queue.h"
+#include "grid_file.h"
 #include <stdint.h>
 
 // Functionality configurators
@@ -13,6 +14,11 @@
 #define DEFAULT_WIDTH 640
 #define DEFAULT_HEIGHT 480
 
+// Image size limits, CLI stills are streamed so they can be far larger
+#define IMAGE_SIZE_MIN 50
+#define IMAGE_SIZE_MAX 10000
+#define CLI_IMAGE_SIZE_MAX 1000000
+
 // Toggling between image sizes
 #define WIDTH_A 640
 #define HEIGHT_A 480
@@ -23,8 +29,8 @@ typedef struct {
   int fd_in;
   int fd_out;
   comp_ctx *ctx;
-  uint8_t *image;
   bool computing_lock;
+  grid_file *opened; // --open grid shown or recoloured instead of computing
 } app_state;
 
 struct arguments {
@@ -40,9 +46,31 @@ struct arguments {
   int anim_fps;
   int anim_duration;
   double anim_zoom_factor;
+  int anim_in_flight;       // 0 = derived from the number of CPUs
+  int anim_keyframes;       // Per zoom doubling, 0 = render every frame
+  const char *video_codec;  // NULL = libx264
+  const char *video_preset; // NULL = encoder default
+  int video_crf;            // < 0 = default
+  int video_threads;        // 0 = one per CPU
+  int video_thread_type;    // FF_THREAD_* bits, 0 = frame and slice
+  int png_level;            // zlib level, < 0 = default
+  int png_filter;           // png_row_filter, 0 = adaptive
+  int anim_stream;          // frame_stream_format, 0 = encode with libavcodec
+  const char *open_path;    // .grid file to show or recolour, NULL = compute
+  int palette;              // Index into palette_gradients
+  const char *jobs_path;    // Stills to render one per line, NULL = one
+  int frame_start;          // First animation frame to render
+  int frame_end;            // Past the last one, 0 = the whole animation
+  bool concat;              // Join the segments instead of rendering
+  char **segments;          // Video files to join, from the arguments
+  int nbr_segments;
+  int antialias;            // Index into aa_patterns, 0 = off
 };
 
 bool module_handshake(app_state *state);
+// Parses a line of options, split at white space, over args, errors are
+// reported and make it return false (the line is modified)
+bool parse_args_line(char *line, struct arguments *args);
 bool apply_args_to_ctx(struct arguments *args, comp_ctx *ctx);
 void process_event(app_state *state, event *ev);
 void send_command(app_state *state, message_type cmd);
@@ -13,6 +13,7 @@ typedef struct {
   double c_re, c_im;
   double d_re, d_im;
   uint8_t max_iter;
+  uint8_t gen; // View generation of the current parameters
 } module_state;
 
 struct arguments {
@@ -24,10 +25,7 @@ struct arguments {
 void process_event(module_state *state, event *ev);
 void send_command(module_state *state, message_type cmd);
 void send_message(module_state *state, const message *msg);
-void compute_chunk_and_send(
-    module_state *state, uint8_t cid, double re0, double im0, uint8_t n_re,
-    uint8_t n_im
-);
+void compute_chunk_and_send(module_state *state, const msg_compute *chunk);
 uint8_t compute_pixel(
     double c_re, double c_im, double z_re, double z_im, uint8_t max_iter
 );
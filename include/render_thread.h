@@ -0,0 +1,14 @@
+#ifndef __RENDER_THREAD_H__
+#define __RENDER_THREAD_H__
+
+#include "common.h"
+
+#define RENDER_DEFAULT_FPS 60 // Used when the display refresh rate is unknown
+#define RENDER_WAIT_TIMEOUT_MS 100
+
+void render_request_redraw(void);
+void render_request_recolour(void);
+void render_request_helpscreen(void);
+void *render_thread(void *arg);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "event_queue.h"
+#include "palette.h"
 #include <SDL.h>
 
 #define WINDOW_LOOP_SLEEP_INTERVAL 10
@@ -27,8 +28,12 @@ typedef enum {
 int xwin_init(int w, int h);
 int xwin_resize(int w, int h);
 void xwin_close(void);
-void xwin_redraw(int w, int h, unsigned char *img);
-void render_pixel(uint8_t iter, uint8_t *rgb);
+void xwin_redraw(int w, int h, const uint8_t *grid, const palette *pal);
+void xwin_redraw_rects(
+    int w, int h, const uint8_t *grid, const palette *pal,
+    const SDL_Rect *rects, int nbr_rects
+);
+int xwin_refresh_rate(void);
 void xwin_poll_events(void);
 void xwin_set_event_pusher(event_pusher_fn handler);
 void *window_thread(void *arg);
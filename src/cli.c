@@ -1,28 +1,128 @@
 #include "cli.h"
 #include "common.h"
 #include "ffmpeg_writer.h"
+#include "frame_queue.h"
+#include "frame_stream.h"
 #include "image_writer.h"
+#include "keyframe_zoom.h"
 #include "prgsem_main.h"
 
 #include <math.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
+// Rotated grid, then regular grids, rows from the top
+const aa_pattern aa_patterns[AA_PATTERNS] = {
+    {"off", 0},
+    {"rgss",
+     4,
+     {{0.125, -0.375}, {-0.375, -0.125}, {0.375, 0.125}, {-0.125, 0.375}}},
+    {"2x2", 4, {{-0.25, -0.25}, {0.25, -0.25}, {-0.25, 0.25}, {0.25, 0.25}}},
+    {"3x3",
+     9,
+     {{-1 / 3.0, -1 / 3.0}, {0, -1 / 3.0}, {1 / 3.0, -1 / 3.0},
+      {-1 / 3.0, 0}, {0, 0}, {1 / 3.0, 0},
+      {-1 / 3.0, 1 / 3.0}, {0, 1 / 3.0}, {1 / 3.0, 1 / 3.0}}},
+    {"4x4",
+     16,
+     {{-0.375, -0.375}, {-0.125, -0.375}, {0.125, -0.375}, {0.375, -0.375},
+      {-0.375, -0.125}, {-0.125, -0.125}, {0.125, -0.125}, {0.375, -0.125},
+      {-0.375, 0.125}, {-0.125, 0.125}, {0.125, 0.125}, {0.375, 0.125},
+      {-0.375, 0.375}, {-0.125, 0.375}, {0.125, 0.375}, {0.375, 0.375}}}
+};
+
 static volatile int interrupted = 0;
+static FILE *console; // Progress output, stderr when frames go to stdout
 
 static void handle_sigint(int sig) {
   (void)sig;
   interrupted = 1;
-  printf("\nInterrupted. Cleaning up...\n");
+  fprintf(console, "\nInterrupted. Cleaning up...\n");
+}
+
+// Computes the iterations of row y of a w*h view
+static void render_row(
+    uint8_t *iters, int y, int w, int h, double c_re, double c_im,
+    double re_min, double re_max, double im_min, double im_max,
+    uint8_t max_iter
+) {
+  for (int x = 0; x < w; ++x) {
+    double z_re = re_min + x * (re_max - re_min) / w;
+    double z_im = im_max - y * (im_max - im_min) / h;
+    iters[x] = compute_pixel(c_re, c_im, z_re, z_im, max_iter);
+  }
+}
+
+// Renders rows [y0, y1) of a w*h view as RGB into image. With aa, pixels
+// whose iterations differ from a neighbour's are then supersampled, which
+// needs the rows next to the band too; smooth areas cost nothing more.
+static void render_rows(
+    uint8_t *image, int y0, int y1, int w, int h, double c_re, double c_im,
+    double re_min, double re_max, double im_min, double im_max,
+    uint8_t max_iter, const palette *pal, const aa_pattern *aa
+) {
+  if (!aa || aa->count == 0) {
+    uint8_t *iters = safe_alloc(w);
+    for (int y = y0; y < y1; ++y) {
+      render_row(
+          iters, y, w, h, c_re, c_im, re_min, re_max, im_min, im_max, max_iter
+      );
+      palette_apply(pal, iters, w, image + (size_t)(y - y0) * w * 3);
+    }
+    free(iters);
+    return;
+  }
+
+  int top = y0 > 0 ? y0 - 1 : y0;     // First row with iterations
+  int bottom = y1 < h ? y1 : y1 - 1; // Last one
+  uint8_t *iters = safe_alloc((size_t)(bottom - top + 1) * w);
+  for (int y = top; y <= bottom; ++y) {
+    render_row(
+        iters + (size_t)(y - top) * w, y, w, h, c_re, c_im, re_min, re_max,
+        im_min, im_max, max_iter
+    );
+  }
+
+  double d_re = (re_max - re_min) / w, d_im = (im_max - im_min) / h;
+  for (int y = y0; y < y1; ++y) {
+    const uint8_t *row = iters + (size_t)(y - top) * w;
+    const uint8_t *above = y > top ? row - w : row;
+    const uint8_t *below = y < bottom ? row + w : row;
+    uint8_t *rgb = image + (size_t)(y - y0) * w * 3;
+    palette_apply(pal, row, w, rgb);
+    for (int x = 0; x < w; ++x) {
+      uint8_t it = row[x];
+      if ((x == 0 || row[x - 1] == it) && (x == w - 1 || row[x + 1] == it) &&
+          above[x] == it && below[x] == it)
+	continue;
+      unsigned sum[3] = {0};
+      for (int i = 0; i < aa->count; ++i) {
+	double z_re = re_min + (x + aa->offsets[i][0]) * d_re;
+	double z_im = im_max - (y + aa->offsets[i][1]) * d_im;
+	const uint8_t *c =
+	    pal->rgb[compute_pixel(c_re, c_im, z_re, z_im, max_iter)];
+	sum[0] += c[0];
+	sum[1] += c[1];
+	sum[2] += c[2];
+      }
+      for (int i = 0; i < 3; ++i) {
+	rgb[3 * x + i] = (sum[i] + aa->count / 2) / aa->count;
+      }
+    }
+  }
+  free(iters);
 }
 
 void render_image(
     uint8_t *image, int w, int h, double c_re, double c_im, double re_min,
-    double re_max, double im_min, double im_max, uint8_t max_iter
+    double re_max, double im_min, double im_max, uint8_t max_iter,
+    const palette *pal, const aa_pattern *aa
 ) {
   debug(
       "Rendering image with c = %.4f + %.4fi, re:[%.4f,%.4f] im:[%.4f,%.4f] "
@@ -30,23 +130,28 @@ void render_image(
       c_re, c_im, re_min, re_max, im_min, im_max, max_iter
   );
 
+  render_rows(
+      image, 0, h, w, h, c_re, c_im, re_min, re_max, im_min, im_max, max_iter,
+      pal, aa
+  );
+}
+
+// Same as render_image() but leaves the iterations uncoloured
+void render_grid(
+    uint8_t *grid, int w, int h, double c_re, double c_im, double re_min,
+    double re_max, double im_min, double im_max, uint8_t max_iter
+) {
   for (int y = 0; y < h; ++y) {
-    for (int x = 0; x < w; ++x) {
-      double z_re = re_min + x * (re_max - re_min) / w;
-      double z_im = im_max - y * (im_max - im_min) / h;
-      uint8_t iter = compute_pixel(c_re, c_im, z_re, z_im, max_iter);
-      double t = (double)iter / (max_iter + 1.0);
-      int index = (y * w + x) * 3;
-      image[index + 0] = 9 * (1 - t) * t * t * t * 255;
-      image[index + 1] = 15 * (1 - t) * (1 - t) * t * t * 255;
-      image[index + 2] = 8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255;
-    }
+    render_row(
+        grid + (size_t)y * w, y, w, h, c_re, c_im, re_min, re_max, im_min,
+        im_max, max_iter
+    );
   }
 }
 
 static void show_progress(int current, int total) {
-  struct winsize w;
-  ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+  struct winsize w = {0};
+  ioctl(fileno(console), TIOCGWINSZ, &w);
   int terminal_width = w.ws_col > 0 ? w.ws_col : 80;
   int bar_width = terminal_width - 10;
   if (bar_width < 10)
@@ -55,112 +160,785 @@ static void show_progress(int current, int total) {
   double ratio = (double)current / total;
   int filled = (int)(bar_width * ratio);
 
-  printf("\r[");
+  fprintf(console, "\r[");
   for (int i = 0; i < bar_width; ++i) {
-    printf(i < filled ? "=" : " ");
+    fputc(i < filled ? '=' : ' ', console);
+  }
+  fprintf(console, "] %3d%%", (int)(ratio * 100));
+  fflush(console);
+}
+
+// A keyframe is rendered by the workers whose frames need it first and freed
+// after the last frame cut out of it
+typedef struct {
+  int users;     // Frames still to be cut out of it
+  int next_row;  // Next row a worker renders
+  int rows_done; // Ready at KEYFRAME_SCALE * h
+} keyframe_state;
+
+typedef struct {
+  const struct arguments *args;
+  const palette *pal;
+  frame_queue *frames;
+  int total_frames;
+  keyframe_zoom *keyframes; // NULL when every frame is rendered exactly
+  keyframe_state *keys;     // One per keyframe, with keyframes
+  const aa_pattern *aa;     // Antialiased RGB exact frames, NULL = iterations
+  pthread_mutex_t lock;     // Guards keys and the keyframe grids
+  pthread_cond_t key_done;  // Some keyframe got its last row
+  int first_frame; // Of a --frame-range segment, the queue counts from it
+  int gop;         // Ctrl-C finishes the GOP in progress, 0 = stops at once
+} anim_job;
+
+// Frame i shows the start view zoomed by anim_zoom_factor^(i / total) around
+// its centre, computed directly so that frames can be rendered in any order
+static void frame_bounds(
+    const struct arguments *args, int index, int total_frames, double *re_min,
+    double *re_max, double *im_min, double *im_max
+) {
+  double zoom = pow(args->anim_zoom_factor, (double)index / total_frames);
+  double re_center = 0.5 * (args->range_re_min + args->range_re_max);
+  double im_center = 0.5 * (args->range_im_min + args->range_im_max);
+  double re_half_span = (args->range_re_max - args->range_re_min) * 0.5 * zoom;
+  double im_half_span = (args->range_im_max - args->range_im_min) * 0.5 * zoom;
+  *re_min = re_center - re_half_span;
+  *re_max = re_center + re_half_span;
+  *im_min = im_center - im_half_span;
+  *im_max = im_center + im_half_span;
+}
+
+// Zoom level of frame i, log2 of its span relative to the start view
+static double
+frame_level(const struct arguments *args, int index, int total_frames) {
+  return log2(args->anim_zoom_factor) * index / total_frames;
+}
+
+// Renders keyframe k unless it is already, its rows are shared with the
+// other workers needing it meanwhile. Also on Ctrl-C, a frame in flight is
+// still finished.
+static void render_keyframe(anim_job *job, int k) {
+  const struct arguments *args = job->args;
+  keyframe_zoom *kz = job->keyframes;
+  keyframe_state *key = &job->keys[k];
+  int kw = KEYFRAME_SCALE * kz->w;
+  int kh = KEYFRAME_SCALE * kz->h;
+  double re_min, re_max, im_min, im_max;
+  keyframe_zoom_bounds(kz, k, &re_min, &re_max, &im_min, &im_max);
+
+  pthread_mutex_lock(&job->lock);
+  keyframe_zoom_alloc(kz, k);
+  uint8_t *grid = kz->grids[k];
+  while (key->next_row < kh) {
+    int row = key->next_row++;
+    pthread_mutex_unlock(&job->lock);
+    render_row(
+        grid + (size_t)row * kw, row, kw, kh, args->c_re, args->c_im, re_min,
+        re_max, im_min, im_max, args->n
+    );
+    pthread_mutex_lock(&job->lock);
+    if (++key->rows_done == kh)
+      pthread_cond_broadcast(&job->key_done);
+  }
+  while (key->rows_done < kh) {
+    pthread_cond_wait(&job->key_done, &job->lock);
+  }
+  pthread_mutex_unlock(&job->lock);
+}
+
+// Cuts frame i out of its keyframes, those no later frame needs are freed
+static void keyframe_frame(anim_job *job, int i, uint8_t *frame) {
+  double level = frame_level(job->args, i, job->total_frames);
+  int keys[2];
+  float weights[2];
+  int nbr_keys = keyframe_zoom_keys(job->keyframes, level, keys, weights);
+  for (int j = 0; j < nbr_keys; ++j) {
+    render_keyframe(job, keys[j]);
+  }
+  keyframe_zoom_frame(job->keyframes, level, job->pal, frame);
+
+  pthread_mutex_lock(&job->lock);
+  for (int j = 0; j < nbr_keys; ++j) {
+    if (--job->keys[keys[j]].users == 0)
+      keyframe_zoom_free(job->keyframes, keys[j]);
+  }
+  pthread_mutex_unlock(&job->lock);
+}
+
+// Renders whichever frame the queue hands out next until none is left, as
+// iterations or, from keyframes or antialiased, as RGB
+static void *render_worker(void *arg) {
+  anim_job *job = arg;
+  const struct arguments *args = job->args;
+  uint8_t *frame;
+  int index;
+  while ((!interrupted || job->gop) &&
+         (frame = frame_queue_acquire(job->frames, &index))) {
+    int i = job->first_frame + index;
+    if (job->keyframes) {
+      keyframe_frame(job, i, frame);
+    } else {
+      double re_min, re_max, im_min, im_max;
+      frame_bounds(
+          args, i, job->total_frames, &re_min, &re_max, &im_min, &im_max
+      );
+      if (job->aa) {
+	render_rows(
+	    frame, 0, args->h, args->w, args->h, args->c_re, args->c_im,
+	    re_min, re_max, im_min, im_max, args->n, job->pal, job->aa
+	);
+      } else {
+	render_grid(
+	    frame, args->w, args->h, args->c_re, args->c_im, re_min, re_max,
+	    im_min, im_max, args->n
+	);
+      }
+    }
+    frame_queue_submit(job->frames, frame, index);
+  }
+  frame_queue_close(job->frames); // on Ctrl-C stop the other workers too
+  return NULL;
+}
+
+// A still image, alone or one of a --jobs batch, rendered in bands of
+// CLI_BAND_ROWS rows
+typedef struct {
+  struct arguments args; // Its view, output_path is where it goes
+  palette pal;
+  bool grid;      // Bands hold iterations instead of RGB
+  int first_band; // Index of its first band over the whole batch
+  int nbr_bands;
+  int line;       // In the job file
+  char *text;     // The line, args point into it
+  char *path;     // output_path made from the --output pattern, or NULL
+  bool ok;        // Saved completely
+  double seconds; // From the previous image being saved to this one
+} still_image;
+
+typedef struct {
+  still_image *images;
+  int nbr_images;
+  frame_queue *bands; // Bands of all images in order, sized for the widest
+} still_job;
+
+// The image band index (over the batch) belongs to
+static const still_image *band_image(const still_job *job, int index) {
+  int lo = 0, hi = job->nbr_images - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (job->images[mid].first_band <= index)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return &job->images[lo];
+}
+
+// Renders and colours whichever band the queue hands out next
+static void *band_worker(void *arg) {
+  still_job *job = arg;
+  uint8_t *band;
+  int index;
+  while (!interrupted && (band = frame_queue_acquire(job->bands, &index))) {
+    const still_image *im = band_image(job, index);
+    const struct arguments *args = &im->args;
+    int y0 = (index - im->first_band) * CLI_BAND_ROWS;
+    int y1 = y0 + CLI_BAND_ROWS < args->h ? y0 + CLI_BAND_ROWS : args->h;
+    if (!im->grid) {
+      render_rows(
+          band, y0, y1, args->w, args->h, args->c_re, args->c_im,
+          args->range_re_min, args->range_re_max, args->range_im_min,
+          args->range_im_max, args->n, &im->pal,
+          &aa_patterns[args->antialias]
+      );
+    } else {
+      for (int y = y0; y < y1; ++y) {
+	render_row(
+	    band + (size_t)(y - y0) * args->w, y, args->w, args->h,
+	    args->c_re, args->c_im, args->range_re_min, args->range_re_max,
+	    args->range_im_min, args->range_im_max, args->n
+	);
+      }
+    }
+    frame_queue_submit(job->bands, band, index);
+  }
+  frame_queue_close(job->bands);
+  return NULL;
+}
+
+static int cpu_count(void) {
+  long nbr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return nbr_cpus < 1 ? 1 : nbr_cpus;
+}
+
+// Starts up to nbr threads running fn on job, returns how many started
+static int
+start_workers(pthread_t *threads, int nbr, void *(*fn)(void *), void *job) {
+  int nbr_started = 0;
+  for (; nbr_started < nbr; ++nbr_started) {
+    if (pthread_create(&threads[nbr_started], NULL, fn, job))
+      break;
+  }
+  return nbr_started;
+}
+
+static void join_workers(pthread_t *threads, int nbr) {
+  for (int i = 0; i < nbr; ++i) {
+    pthread_join(threads[i], NULL);
   }
-  printf("] %3d%%", (int)(ratio * 100));
-  fflush(stdout);
 }
 
 bool save_image_auto(const char *path, uint8_t *image, int w, int h) {
-  const char *ext = strrchr(path, '.');
-  if (!ext)
+  image_stream *s = image_stream_open(path, w, h, NULL);
+  if (!s)
     return false;
+  bool ok = image_stream_write(s, image, h);
+  return image_stream_close(s) && ok;
+}
 
-  if (strcmp(ext, ".png") == 0) {
-    return save_image_png(path, image, w, h);
-  } else if (strcmp(ext, ".jpg") == 0 || strcmp(ext, ".jpeg") == 0) {
-    return save_image_jpg(path, image, w, h);
-  } else {
-    error("Unsupported image format (use .png or .jpg)");
+// Opens the output of a still image, a .grid file keeps its view. PNG files
+// are compressed by pool, NULL = by threads of their own.
+static image_stream *open_still(const struct arguments *args, png_pool *pool) {
+  if (image_path_is_grid(args->output_path)) {
+    grid_file_header header = {
+        .magic = GRID_FILE_MAGIC,
+        .version = GRID_FILE_VERSION,
+        .header_size = GRID_FILE_DATA_OFFSET,
+        .w = args->w,
+        .h = args->h,
+        .n = args->n,
+        .c_re = args->c_re,
+        .c_im = args->c_im,
+        .re_min = args->range_re_min,
+        .re_max = args->range_re_max,
+        .im_min = args->range_im_min,
+        .im_max = args->range_im_max,
+        .tile_w = GRID_FILE_TILE,
+        .tile_h = GRID_FILE_TILE
+    };
+    return grid_stream_open(args->output_path, &header);
+  }
+  png_options png = {
+      .level = args->png_level, .filter = args->png_filter, .pool = pool
+  };
+  return image_stream_open(args->output_path, args->w, args->h, &png);
+}
+
+// Seconds since *t, which becomes now
+static double lap(struct timespec *t) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double elapsed = (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+  *t = now;
+  return elapsed;
+}
+
+// Closes the output of im, a file with rows missing is removed
+static void
+finish_still(still_image *im, image_stream *image, struct timespec *t) {
+  im->ok = image_stream_close(image) && im->ok;
+  if (!im->ok) {
+    error("Failed to save %s", im->args.output_path);
+    remove(im->args.output_path);
+  }
+  im->seconds = lap(t);
+}
+
+// Renders the still images in bands on all CPUs and streams each to its file
+// in order. The workers go on with the next bands, also of the next images,
+// while this thread writes, memory is bounded by the bands in flight. Write
+// errors and interruptions leave rows missing, which image_stream_close()
+// reports. The PNG files are compressed one after another by one pool.
+static void render_stills(still_image *images, int nbr_images) {
+  int nbr_cpus = cpu_count();
+  int nbr_bands = 0;
+  size_t band_size = 0;
+  for (int i = 0; i < nbr_images; ++i) {
+    still_image *im = &images[i];
+    size_t size = (size_t)CLI_BAND_ROWS * im->args.w * (im->grid ? 1 : 3);
+    band_size = size > band_size ? size : band_size;
+    im->first_band = nbr_bands;
+    im->nbr_bands = (im->args.h + CLI_BAND_ROWS - 1) / CLI_BAND_ROWS;
+    nbr_bands += im->nbr_bands;
+  }
+  still_job job = {
+      .images = images,
+      .nbr_images = nbr_images,
+      .bands = frame_queue_create(
+          band_size, nbr_cpus + CLI_EXTRA_FRAMES_IN_FLIGHT, nbr_bands
+      )
+  };
+  pthread_t *workers = safe_alloc(nbr_cpus * sizeof(pthread_t));
+  int nbr_started = start_workers(workers, nbr_cpus, band_worker, &job);
+  if (nbr_started == 0) {
+    error("Failed to start render threads");
+    frame_queue_close(job.bands);
+  }
+
+  png_pool *png = png_pool_create(0);
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  still_image *im = images;
+  image_stream *image = NULL;
+  uint8_t *band;
+  for (int i = 0; (band = frame_queue_pop(job.bands)); ++i) {
+    int y = (i - im->first_band) * CLI_BAND_ROWS;
+    int rows = im->args.h - y < CLI_BAND_ROWS ? im->args.h - y : CLI_BAND_ROWS;
+    if (y == 0)
+      im->ok = (image = open_still(&im->args, png)) != NULL;
+    if (im->ok && !image_stream_write(image, band, rows)) {
+      im->ok = false; // its other bands are dropped
+      if (im == &images[nbr_images - 1])
+	frame_queue_close(job.bands); // only drain what is already rendering
+    }
+    frame_queue_release(job.bands, band);
+    if (y + rows == im->args.h) {
+      if (image)
+	finish_still(im, image, &t);
+      else
+	im->seconds = lap(&t); // not opened, its time is not the next one's
+      image = NULL;
+      ++im;
+    }
+    show_progress(i + 1, nbr_bands);
+  }
+  if (image)
+    finish_still(im, image, &t); // cut short
+  fprintf(console, "\n");
+
+  join_workers(workers, nbr_started);
+  free(workers);
+  frame_queue_destroy(job.bands);
+  png_pool_destroy(png);
+}
+
+// Colours the iterations of an opened grid file band by band, or copies them
+// without pal, nothing is computed
+static void recolour_grid(
+    image_stream *image, const grid_file *g, const palette *pal
+) {
+  int w = g->header.w, h = g->header.h;
+  int nbr_bands = (h + CLI_BAND_ROWS - 1) / CLI_BAND_ROWS;
+  uint8_t *iters = safe_alloc((size_t)CLI_BAND_ROWS * w);
+  uint8_t *band = pal ? safe_alloc((size_t)CLI_BAND_ROWS * w * 3) : iters;
+  for (int i = 0; i < nbr_bands && !interrupted; ++i) {
+    int rows = h - i * CLI_BAND_ROWS;
+    rows = rows < CLI_BAND_ROWS ? rows : CLI_BAND_ROWS;
+    grid_file_read_rows(g, i * CLI_BAND_ROWS, rows, iters);
+    if (pal)
+      palette_apply(pal, iters, (size_t)rows * w, band);
+    if (!image_stream_write(image, band, rows))
+      break;
+    show_progress(i + 1, nbr_bands);
+  }
+  fprintf(console, "\n");
+  if (band != iters)
+    free(band);
+  free(iters);
+}
+
+// Frames are streamed uncompressed when asked to, or for stdout and .y4m
+static frame_stream_format stream_format(const struct arguments *args) {
+  const char *ext = strrchr(args->output_path, '.');
+  if (args->anim_stream != FRAME_STREAM_NONE)
+    return args->anim_stream;
+  if (strcmp(args->output_path, FRAME_STREAM_STDOUT) == 0 ||
+      (ext && strcmp(ext, ".y4m") == 0))
+    return FRAME_STREAM_Y4M;
+  return FRAME_STREAM_NONE;
+}
+
+// True for an --output path with one %d (a 0 flag and width allowed) and
+// otherwise only %% escapes, safe to give to snprintf() with the job number
+static bool output_pattern_valid(const char *pattern) {
+  int nbr_numbers = 0;
+  for (const char *p = strchr(pattern, '%'); p; p = strchr(p, '%')) {
+    ++p;
+    if (*p == '%') {
+      ++p;
+      continue;
+    }
+    size_t digits = strspn(p, "0123456789");
+    if (digits > 2 || p[digits] != 'd')
+      return false;
+    p += digits + 1;
+    ++nbr_numbers;
+  }
+  return nbr_numbers == 1;
+}
+
+// Checks the options of job number (counting every job line from 1) and
+// gives it its output path, the other options come from the command line
+static bool job_prepare(
+    still_image *im, const struct arguments *base, int number
+) {
+  struct arguments *args = &im->args;
+  if (args->jobs_path != base->jobs_path || args->open_path ||
+      args->concat || args->anim_duration > 0) {
+    error(
+        "A job is one still, --jobs, --open, --concat or --anim-duration are "
+        "invalid"
+    );
+    return false;
+  }
+  if (args->range_re_min >= args->range_re_max ||
+      args->range_im_min >= args->range_im_max) {
+    error("Invalid coordinate range");
+    return false;
+  }
+  if (!args->output_path) {
+    if (!base->output_path || !output_pattern_valid(base->output_path)) {
+      error("No --output on the line and no %%d pattern in --output");
+      return false;
+    }
+    int len = snprintf(NULL, 0, base->output_path, number) + 1;
+    im->path = safe_alloc(len);
+    snprintf(im->path, len, base->output_path, number);
+    args->output_path = im->path;
+  }
+  im->grid = image_path_is_grid(args->output_path);
+  palette_init(&im->pal, palette_gradients[args->palette].fn);
+  palette_update(&im->pal, args->n);
+  return true;
+}
+
+// Reads a job file: every line that is neither empty nor a # comment holds
+// the options of one still over those of the command line. Invalid lines
+// are reported and skipped.
+static bool read_jobs(
+    const struct arguments *args, still_image **images, int *nbr_images,
+    int *nbr_skipped
+) {
+  FILE *fp = fopen(args->jobs_path, "r");
+  if (!fp) {
+    error("Failed to open %s", args->jobs_path);
+    return false;
+  }
+
+  int capacity = 0;
+  *images = NULL;
+  *nbr_images = *nbr_skipped = 0;
+  char *text = NULL;
+  size_t text_size = 0;
+  for (int line = 1; getline(&text, &text_size, fp) != -1; ++line) {
+    char first = text[strspn(text, " \t\r\n")];
+    if (first == '\0' || first == '#')
+      continue;
+    if (*nbr_images == capacity) {
+      capacity = capacity ? 2 * capacity : 64;
+      still_image *grown = safe_alloc(capacity * sizeof(still_image));
+      memcpy(grown, *images, *nbr_images * sizeof(still_image));
+      free(*images);
+      *images = grown;
+    }
+
+    still_image *im = &(*images)[*nbr_images];
+    *im = (still_image){.args = *args, .line = line, .text = text};
+    im->args.output_path = NULL;
+    if (!parse_args_line(text, &im->args) ||
+        !job_prepare(im, args, *nbr_images + *nbr_skipped + 1)) {
+      error("%s:%d: job skipped", args->jobs_path, line);
+      ++*nbr_skipped;
+      continue; // text is read over
+    }
+    text = NULL; // kept by the image
+    text_size = 0;
+    ++*nbr_images;
   }
-  return false;
+  free(text);
+  fclose(fp);
+  return true;
+}
+
+static void print_jobs_summary(
+    const still_image *images, int nbr_images, int nbr_skipped, double seconds
+) {
+  int nbr_failed = 0;
+  double pixels = 0;
+  fprintf(console, "\n[Jobs - Summary]\n");
+  fprintf(
+      console, "%5s  %-13s %3s %9s  %s\n", "Line", "Size", "n", "Time [s]",
+      "Output"
+  );
+  for (int i = 0; i < nbr_images; ++i) {
+    const still_image *im = &images[i];
+    char size[32];
+    snprintf(size, sizeof(size), "%dx%d", im->args.w, im->args.h);
+    fprintf(
+        console, "%5d  %-13s %3d %9.3f  %s%s\n", im->line, size, im->args.n,
+        im->seconds, im->args.output_path, im->ok ? "" : " (failed)"
+    );
+    if (im->ok)
+      pixels += (double)im->args.w * im->args.h;
+    else
+      ++nbr_failed;
+  }
+  int nbr_saved = nbr_images - nbr_failed;
+  seconds = seconds > 0 ? seconds : 1e-9;
+  fprintf(
+      console,
+      "%d images in %.3f s (%.1f per second, %.1f Mpx/s), %d failed, %d "
+      "skipped\n\n",
+      nbr_saved, seconds, nbr_saved / seconds, pixels / 1e6 / seconds,
+      nbr_failed, nbr_skipped
+  );
+}
+
+// Renders every still of the job file in this one process, the bands of all
+// of them share the workers and buffers of one queue
+static int run_jobs(const struct arguments *args) {
+  still_image *images;
+  int nbr_images, nbr_skipped;
+  if (!read_jobs(args, &images, &nbr_images, &nbr_skipped))
+    return EXIT_FAILURE;
+  info("Rendering %d images from %s", nbr_images, args->jobs_path);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (nbr_images > 0)
+    render_stills(images, nbr_images);
+  print_jobs_summary(images, nbr_images, nbr_skipped, lap(&start));
+
+  bool ok = nbr_skipped == 0 && !interrupted;
+  for (int i = 0; i < nbr_images; ++i) {
+    ok = ok && images[i].ok;
+    free(images[i].text);
+    free(images[i].path);
+  }
+  free(images);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int cli_main(app_state *state, struct arguments *args) {
+  console = stdout;
   signal(SIGINT, handle_sigint);
 
   int w = args->w;
   int h = args->h;
-  uint8_t *image = malloc(w * h * 3);
-  if (!image) {
-    error("Memory allocation failed");
-    return EXIT_FAILURE;
-  }
 
-  double re_min = args->range_re_min;
-  double re_max = args->range_re_max;
-  double im_min = args->range_im_min;
-  double im_max = args->range_im_max;
+  palette pal;
+  palette_init(&pal, palette_gradients[args->palette].fn);
+  palette_update(&pal, args->n);
 
   debug("CLI tool started");
 
-  if (args->output_path && args->anim_duration == 0) {
-    debug("Rendering static image to %s", args->output_path);
-    render_image(
-        image, w, h, args->c_re, args->c_im, re_min, re_max, im_min, im_max,
-        args->n
-    );
-    if (!save_image_auto(args->output_path, image, w, h)) {
-      error("Failed to save output image");
-      free(image);
+  if (args->concat) {
+    if (!args->output_path || args->nbr_segments == 0) {
+      error("--concat needs --output and the segment files as arguments");
+      return EXIT_FAILURE;
+    }
+    if (!ffmpeg_concat(
+            args->output_path, args->segments, args->nbr_segments
+        )) {
+      error("Failed to join the segments into %s", args->output_path);
       return EXIT_FAILURE;
     }
+    info("Joined %d segments into %s", args->nbr_segments, args->output_path);
+    return EXIT_SUCCESS;
+  } else if (args->jobs_path) {
+    if (state->opened) {
+      error("An opened grid cannot be combined with --jobs");
+      return EXIT_FAILURE;
+    }
+    return run_jobs(args);
+  } else if (args->output_path && args->anim_duration == 0) {
+    debug("Rendering static image to %s", args->output_path);
+    if (state->opened) {
+      image_stream *image = open_still(args, NULL);
+      if (!image) {
+	error("Failed to create output image");
+	return EXIT_FAILURE;
+      }
+      bool grid = image_path_is_grid(args->output_path);
+      recolour_grid(image, state->opened, grid ? NULL : &pal);
+      if (!image_stream_close(image)) {
+	error("Failed to save output image");
+	remove(args->output_path);
+	return EXIT_FAILURE;
+      }
+    } else {
+      still_image im = {
+          .args = *args,
+          .pal = pal,
+          .grid = image_path_is_grid(args->output_path)
+      };
+      render_stills(&im, 1);
+      if (!im.ok)
+	return EXIT_FAILURE;
+    }
     info("Saved image to %s", args->output_path);
-    free(image);
     return EXIT_SUCCESS;
+  } else if (state->opened) {
+    error("An opened grid can only be recoloured into an image");
+    return EXIT_FAILURE;
   } else if (args->anim_duration > 0 && args->output_path) {
     debug("Rendering animation to %s", args->output_path);
-    const char *ext = strrchr(args->output_path, '.');
-    if (!ext || (strcmp(ext, ".mp4") != 0)) {
-      error("Unsupported animation format (only .mp4 supported)");
-      free(image);
+    // a --frame-range segment holds whole GOPs of one second, so that the
+    // segments can be joined without re-encoding
+    int total_frames = args->anim_duration * args->anim_fps;
+    bool segment = args->frame_end > 0;
+    int first = args->frame_start;
+    int end = segment ? args->frame_end : total_frames;
+    if (end > total_frames ||
+        (segment && (first % args->anim_fps != 0 ||
+                     (end % args->anim_fps != 0 && end != total_frames)))) {
+      error(
+          "Frame range must be within the %d frames, on whole seconds (%d "
+          "frames)",
+          total_frames, args->anim_fps
+      );
       return EXIT_FAILURE;
     }
+    int nbr_frames = end - first;
 
-    ffmpeg_writer *video =
-        ffmpeg_writer_create(args->output_path, w, h, args->anim_fps);
-    if (!video) {
+    ffmpeg_writer *video = NULL;
+    frame_stream *stream = NULL;
+    frame_stream_format format = stream_format(args);
+    if (format != FRAME_STREAM_NONE) {
+      if (strcmp(args->output_path, FRAME_STREAM_STDOUT) == 0)
+	console = stderr;
+      stream = frame_stream_create(
+          args->output_path, w, h, args->anim_fps, format
+      );
+    } else {
+      ffmpeg_profile profile = {
+          .codec = args->video_codec,
+          .preset = args->video_preset,
+          .crf = args->video_crf,
+          .threads = args->video_threads,
+          .thread_type = args->video_thread_type,
+          .gop = segment ? args->anim_fps : 0
+      };
+      video = ffmpeg_writer_create(
+          args->output_path, w, h, args->anim_fps, &profile
+      );
+    }
+    if (!video && !stream) {
       error("Failed to initialize video writer");
-      free(image);
       return EXIT_FAILURE;
     }
 
-    int total_frames = args->anim_duration * args->anim_fps;
-    double zoom_per_frame = pow(args->anim_zoom_factor, 1.0 / total_frames);
+    int nbr_cpus = cpu_count();
+    int in_flight = args->anim_in_flight > 0
+                        ? args->anim_in_flight
+                        : nbr_cpus + CLI_EXTRA_FRAMES_IN_FLIGHT;
+    int nbr_workers = nbr_cpus < in_flight ? nbr_cpus : in_flight;
     debug(
-        "Total frames: %d, FPS: %d, Zoom/frame: %.6f", total_frames,
-        args->anim_fps, zoom_per_frame
+        "Frames: %d to %d of %d, FPS: %d, workers: %d, frames in flight: %d",
+        first, end - 1, total_frames, args->anim_fps, nbr_workers, in_flight
     );
 
-    for (int i = 0; i < total_frames && !interrupted; ++i) {
-      render_image(
-          image, w, h, args->c_re, args->c_im, re_min, re_max, im_min, im_max,
-          args->n
-      );
-      ffmpeg_writer_add_frame(video, image);
+    anim_job job = {
+        .args = args,
+        .pal = &pal,
+        .total_frames = total_frames,
+        .first_frame = first
+    };
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.key_done, NULL);
+    pthread_t *workers = safe_alloc(nbr_cpus * sizeof(pthread_t));
 
-      double re_center = 0.5 * (re_min + re_max);
-      double im_center = 0.5 * (im_min + im_max);
-      double re_half_span = (re_max - re_min) * 0.5 * zoom_per_frame;
-      double im_half_span = (im_max - im_min) * 0.5 * zoom_per_frame;
-      re_min = re_center - re_half_span;
-      re_max = re_center + re_half_span;
-      im_min = im_center - im_half_span;
-      im_max = im_center + im_half_span;
+    // A few supersampled keyframes replace rendering every frame, unless
+    // they would take longer than that. This is decided for the whole
+    // animation so that segments look alike, each renders only its own.
+    // Frames are rendered in order, so only the keyframes of those in
+    // flight are held.
+    if (args->anim_keyframes > 0) {
+      int count =
+          keyframe_zoom_count(args->anim_zoom_factor, args->anim_keyframes);
+      if (count * KEYFRAME_SCALE * KEYFRAME_SCALE < total_frames) {
+	job.keyframes = keyframe_zoom_create(
+	    w, h, args->range_re_min, args->range_re_max, args->range_im_min,
+	    args->range_im_max, args->anim_zoom_factor, args->anim_keyframes
+	);
+	job.keys = safe_alloc(count * sizeof(keyframe_state));
+	memset(job.keys, 0, count * sizeof(keyframe_state));
+	int nbr_used = 0;
+	for (int i = first; i < end; ++i) {
+	  int keys[2];
+	  float weights[2];
+	  int nbr_keys = keyframe_zoom_keys(
+	      job.keyframes, frame_level(args, i, total_frames), keys, weights
+	  );
+	  for (int j = 0; j < nbr_keys; ++j) {
+	    nbr_used += job.keys[keys[j]].users++ == 0;
+	  }
+	}
+	info("Rendering %d of %d keyframes", nbr_used, count);
+      } else {
+	info("Rendering every frame, cheaper than %d keyframes", count);
+      }
+    }
+    job.gop = segment ? args->anim_fps : 0;
+    // keyframes are supersampled already
+    if (!job.keyframes && aa_patterns[args->antialias].count > 0)
+      job.aa = &aa_patterns[args->antialias];
+    bool rgb = job.keyframes || job.aa;
 
-      show_progress(i + 1, total_frames);
+    // Workers render frames in parallel while this thread feeds them to the
+    // encoder in order, memory is bounded by the frames in flight
+    size_t frame_size = (size_t)w * h * (rgb ? 3 : 1);
+    job.frames = frame_queue_create(frame_size, in_flight, nbr_frames);
+    int nbr_started = start_workers(workers, nbr_workers, render_worker, &job);
+    if (nbr_started == 0) {
+      error("Failed to start render threads");
+      frame_queue_close(job.frames);
     }
 
-    printf("\n");
-    ffmpeg_writer_close(video);
-    info("Animation saved to %s", args->output_path);
+    // also on Ctrl-C: the frames already being rendered are encoded (in a
+    // segment up to the end of the GOP), then the file is finalized. A stream
+    // blocks here while its reader is behind, and once the reader is gone only
+    // the frames in flight are drained.
+    uint8_t *frame;
+    int nbr_encoded = 0;
+    bool ok = true;
+    while ((frame = frame_queue_pop(job.frames))) {
+      if (!stream) {
+	if (rgb)
+	  ffmpeg_writer_add_frame(video, frame);
+	else
+	  ffmpeg_writer_add_grid(video, frame, &pal);
+      } else if (ok) {
+	if (rgb)
+	  ok = frame_stream_add_frame(stream, frame);
+	else
+	  ok = frame_stream_add_grid(stream, frame, &pal);
+	if (!ok) {
+	  error("Failed to write frame %d, reader gone?", nbr_encoded);
+	  frame_queue_close(job.frames); // only drain what is in flight
+	}
+      }
+      frame_queue_release(job.frames, frame);
+      if (interrupted && job.gop)
+	frame_queue_stop_at(job.frames, job.gop);
+      show_progress(++nbr_encoded, nbr_frames);
+    }
+
+    fprintf(console, "\n");
+    join_workers(workers, nbr_started);
+    free(workers);
+    frame_queue_destroy(job.frames);
+    keyframe_zoom_destroy(job.keyframes);
+    free(job.keys);
+    pthread_cond_destroy(&job.key_done);
+    pthread_mutex_destroy(&job.lock);
+    if (segment && ok && nbr_encoded < nbr_frames) {
+      warning(
+          "Frames %d to %d are missing, render them with --frame-range %d %d",
+          first + nbr_encoded, end - 1, first + nbr_encoded, end
+      );
+    }
+    if (stream) {
+      if (!frame_stream_close(stream) || !ok)
+	return EXIT_FAILURE;
+      info("Animation streamed to %s", args->output_path);
+    } else {
+      ffmpeg_writer_close(video);
+      info("Animation saved to %s", args->output_path);
+    }
   } else {
     error("Not enough arguments given for image or video generation");
   }
 
-  free(image);
   debug("CLI tool exiting");
   return interrupted ? EXIT_FAILURE : EXIT_SUCCESS;
 }
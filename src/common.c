@@ -1,7 +1,10 @@
 #include "common.h"
 
+#include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 static log_level_t current_log_level = LOG_LEVEL_INFO;
@@ -38,3 +41,24 @@ void *safe_alloc(size_t size) {
   }
   return ret;
 }
+
+// Writes all of iov with as few calls as possible, resuming partial writes.
+// iov is consumed.
+bool write_all(int fd, struct iovec *iov, int cnt) {
+  while (cnt > 0) {
+    ssize_t n = writev(fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR)
+	continue;
+      return false;
+    }
+    for (; cnt > 0 && (size_t)n >= iov->iov_len; ++iov, --cnt) {
+      n -= iov->iov_len;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (uint8_t *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return true;
+}
@@ -6,6 +6,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+// Caller holds ctx->mtx
+static void rewind_chunks(comp_ctx *ctx) {
+  ctx->cid = 0;
+  ctx->cur_x = 0;
+  ctx->cur_y = 0;
+  ctx->chunk_re = ctx->range_re_min;
+  ctx->chunk_im = ctx->range_im_max;
+}
+
 comp_ctx *computation_create(void) {
   comp_ctx *ctx = safe_alloc(sizeof(comp_ctx));
   *ctx = (comp_ctx){.c_re = -0.4,
@@ -19,10 +28,23 @@ comp_ctx *computation_create(void) {
                     .grid_h = 480,
                     .chunk_n_re = 64,
                     .chunk_n_im = 48};
+  pthread_mutex_init(&ctx->mtx, NULL);
   return ctx;
 }
 
-void ctx_update(comp_ctx *ctx) {
+// Caller holds ctx->mtx
+static void mark_dirty_locked(comp_ctx *ctx, int x, int y, int w, int h) {
+  if (ctx->nbr_dirty < 0)
+    return;
+  if (ctx->nbr_dirty == DIRTY_RECTS_MAX) {
+    ctx->nbr_dirty = -1;
+    return;
+  }
+  ctx->dirty[ctx->nbr_dirty++] = (grid_rect){.x = x, .y = y, .w = w, .h = h};
+}
+
+// Caller holds ctx->mtx
+static void ctx_update_locked(comp_ctx *ctx) {
   int w = ctx->grid_w;
   int h = ctx->grid_h;
 
@@ -44,14 +66,129 @@ void ctx_update(comp_ctx *ctx) {
   ctx->done = false;
   ctx->abort = false;
 
-  free(ctx->grid);
-  ctx->grid = safe_alloc(w * h);
+  size_t len = (size_t)w * h;
+  if (len != ctx->grid_len) {
+    free(ctx->grid);
+    free(ctx->known);
+    free(ctx->orbit);
+    ctx->grid = safe_alloc(len);
+    ctx->known = safe_alloc(len);
+    ctx->orbit = safe_alloc(len * sizeof(orbit_z));
+    ctx->grid_len = len;
+    memset(ctx->known, 0, len);
+  }
+  ctx->nbr_dirty = -1;
+  ctx->gen++;
+}
+
+void ctx_update(comp_ctx *ctx) {
+  pthread_mutex_lock(&ctx->mtx);
+  ctx_update_locked(ctx);
+  pthread_mutex_unlock(&ctx->mtx);
+}
+
+// Caller holds ctx->mtx
+static void set_grid_size_locked(comp_ctx *ctx, int w, int h) {
+  ctx->grid_w = w;
+  ctx->grid_h = h;
+  ctx->chunk_n_re = w / CHUNK_SIZE_FACTOR;
+  ctx->chunk_n_im = h / CHUNK_SIZE_FACTOR;
+  ctx_update_locked(ctx);
+}
+
+void set_grid_size(comp_ctx *ctx, int w, int h) {
+  pthread_mutex_lock(&ctx->mtx);
+  set_grid_size_locked(ctx, w, h);
+  pthread_mutex_unlock(&ctx->mtx);
+}
+
+// Moves the view, the new generation tells local jobs of the old one apart
+void set_view(
+    comp_ctx *ctx, double re_min, double re_max, double im_min, double im_max
+) {
+  pthread_mutex_lock(&ctx->mtx);
+  ctx->range_re_min = re_min;
+  ctx->range_re_max = re_max;
+  ctx->range_im_min = im_min;
+  ctx->range_im_max = im_max;
+  ctx->gen++;
+  pthread_mutex_unlock(&ctx->mtx);
+}
+
+// Carries samples over to a new pixel lattice of size w*h whose pixel (x, y)
+// lies on old pixel (off_x + x * num / den, off_y + y * num / den), i.e. a
+// 2x zoom (num/den = 1/2 or 2/1) or resolution change. The ranges must
+// already describe the new view. Pixels landing exactly on a known old
+// sample stay known, the others get the nearest old value as a preview.
+void rescale_grid(
+    comp_ctx *ctx, int w, int h, int num, int den, int off_x, int off_y
+) {
+  pthread_mutex_lock(&ctx->mtx);
+  int old_w = ctx->grid_w, old_h = ctx->grid_h;
+  size_t old_len = ctx->grid_len;
+  uint8_t *old_grid = safe_alloc(2 * old_len);
+  uint8_t *old_known = old_grid + old_len;
+  orbit_z *old_orbit = safe_alloc(old_len * sizeof(orbit_z));
+  memcpy(old_grid, ctx->grid, old_len);
+  memcpy(old_known, ctx->known, old_len);
+  memcpy(old_orbit, ctx->orbit, old_len * sizeof(orbit_z));
+
+  set_grid_size_locked(ctx, w, h);
+  for (int y = 0; y < h; ++y) {
+    int oy = off_y + y * num / den;
+    bool on_row = (y * num) % den == 0;
+    for (int x = 0; x < w; ++x) {
+      int ox = off_x + x * num / den;
+      size_t idx = (size_t)y * w + x;
+      if (ox < 0 || ox >= old_w || oy < 0 || oy >= old_h) {
+	ctx->grid[idx] = 0;
+	ctx->known[idx] = 0;
+      } else {
+	size_t old_idx = (size_t)oy * old_w + ox;
+	ctx->grid[idx] = old_grid[old_idx];
+	ctx->known[idx] =
+	    on_row && (x * num) % den == 0 ? old_known[old_idx] : 0;
+	ctx->orbit[idx] = old_orbit[old_idx];
+      }
+    }
+  }
+  pthread_mutex_unlock(&ctx->mtx);
+  free(old_grid);
+  free(old_orbit);
+}
+
+// Changes the iteration limit keeping whatever stays valid. Lowering n only
+// clamps the grid. Raising it invalidates just the pixels that reached the
+// old n, those with a kept orbit are then resumed instead of recomputed.
+void set_iterations(comp_ctx *ctx, int n) {
+  pthread_mutex_lock(&ctx->mtx);
+  int old_n = ctx->n;
+  ctx->n = n;
+  size_t len = (size_t)ctx->grid_w * ctx->grid_h;
+  if (!ctx->grid || len != ctx->grid_len || n == old_n) {
+    pthread_mutex_unlock(&ctx->mtx);
+    return;
+  }
+  for (size_t i = 0; i < len; ++i) {
+    if (n < old_n && ctx->grid[i] >= n) {
+      ctx->grid[i] = n;
+      ctx->known[i] &= ~KNOWN_ORBIT; // z belongs to a later iteration
+    } else if (n > old_n && ctx->grid[i] == old_n) {
+      ctx->known[i] &= ~KNOWN_EXACT;
+    }
+  }
+  ctx->nbr_dirty = -1;
+  ctx->gen++;
+  pthread_mutex_unlock(&ctx->mtx);
 }
 
 void computation_destroy(comp_ctx *ctx) {
   if (!ctx)
     return;
   free(ctx->grid);
+  free(ctx->known);
+  free(ctx->orbit);
+  pthread_mutex_destroy(&ctx->mtx);
   free(ctx);
 }
 
@@ -65,9 +202,11 @@ void get_grid_size(comp_ctx *ctx, int *w, int *h) {
 }
 
 void abort_comp(comp_ctx *ctx) {
+  pthread_mutex_lock(&ctx->mtx);
   ctx->abort = false;
   ctx->done = true;
   ctx->computing = false;
+  pthread_mutex_unlock(&ctx->mtx);
 }
 
 bool set_compute(comp_ctx *ctx, message *msg) {
@@ -80,35 +219,68 @@ bool set_compute(comp_ctx *ctx, message *msg) {
     msg->data.set_compute.d_re = ctx->d_re;
     msg->data.set_compute.d_im = ctx->d_im;
     msg->data.set_compute.n = ctx->n;
+    msg->data.set_compute.gen = ctx->gen;
     ctx->done = false;
   }
   return ret;
 }
 
+// Caller holds ctx->mtx
+static bool advance_chunk_locked(comp_ctx *ctx) {
+  ctx->cid++;
+  if (ctx->cid >= ctx->nbr_chunks) {
+    return false;
+  }
+
+  ctx->cur_x += ctx->chunk_n_re;
+  ctx->chunk_re += ctx->chunk_n_re * ctx->d_re;
+
+  if (ctx->cur_x >= ctx->grid_w) {
+    ctx->cur_x = 0;
+    ctx->cur_y += ctx->chunk_n_im;
+    ctx->chunk_re = ctx->range_re_min;
+    ctx->chunk_im += ctx->chunk_n_im * ctx->d_im;
+  }
+  return true;
+}
+
+// Caller holds ctx->mtx
+static bool chunk_known_locked(comp_ctx *ctx) {
+  for (int y = ctx->cur_y; y < ctx->cur_y + ctx->chunk_n_im; ++y) {
+    const uint8_t *row = ctx->known + (size_t)y * ctx->grid_w + ctx->cur_x;
+    for (int x = 0; x < ctx->chunk_n_re; ++x) {
+      if (!(row[x] & KNOWN_EXACT))
+	return false;
+    }
+  }
+  return true;
+}
+
+// Prepares the next chunk for the module, skipping chunks whose pixels are
+// all known already. Returns false (and marks the computation done) when no
+// chunk is left.
 bool compute(comp_ctx *ctx, message *msg) {
   assertion(msg != NULL, __func__, __LINE__, __FILE__);
   debug("COMPUTE: cid=%d / %d", ctx->cid, ctx->nbr_chunks);
+  pthread_mutex_lock(&ctx->mtx);
+  bool has_chunk = true;
   if (!ctx->computing) {
     // First chunk
-    reset_cid(ctx);
+    rewind_chunks(ctx);
     ctx->computing = true;
     ctx->done = false;
   } else {
     // Next chunk
-    ctx->cid++;
-    if (ctx->cid >= ctx->nbr_chunks) {
-      return false;
-    }
-
-    ctx->cur_x += ctx->chunk_n_re;
-    ctx->chunk_re += ctx->chunk_n_re * ctx->d_re;
-
-    if (ctx->cur_x >= ctx->grid_w) {
-      ctx->cur_x = 0;
-      ctx->cur_y += ctx->chunk_n_im;
-      ctx->chunk_re = ctx->range_re_min;
-      ctx->chunk_im += ctx->chunk_n_im * ctx->d_im;
-    }
+    has_chunk = advance_chunk_locked(ctx);
+  }
+  while (has_chunk && chunk_known_locked(ctx)) {
+    has_chunk = advance_chunk_locked(ctx);
+  }
+  if (!has_chunk) {
+    ctx->done = true;
+    ctx->computing = false;
+    pthread_mutex_unlock(&ctx->mtx);
+    return false;
   }
 
   msg->type = MSG_COMPUTE;
@@ -117,30 +289,87 @@ bool compute(comp_ctx *ctx, message *msg) {
   msg->data.compute.im = ctx->chunk_im;
   msg->data.compute.n_re = ctx->chunk_n_re;
   msg->data.compute.n_im = ctx->chunk_n_im;
+  msg->data.compute.gen = ctx->gen;
+  pthread_mutex_unlock(&ctx->mtx);
 
   return true;
 }
 
-void update_image(comp_ctx *ctx, int w, int h, unsigned char *img) {
-  assertion(
-      img && ctx->grid && w == ctx->grid_w && h == ctx->grid_h, __func__,
-      __LINE__, __FILE__
-  );
-  for (int i = 0; i < w * h; ++i) {
-    double t = 1.0 * ctx->grid[i] / (ctx->n + 1.0);
-    *(img++) = 9 * (1 - t) * t * t * t * 255;
-    *(img++) = 15 * (1 - t) * (1 - t) * t * t * 255;
-    *(img++) = 8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255;
+// Copies the changed part of the grid into the caller's front buffer and
+// returns the changed regions in rects (DIRTY_RECTS_MAX entries), or -1 when
+// the whole grid changed or the front buffer had to be (re)allocated.
+int snapshot_grid(
+    comp_ctx *ctx, uint8_t **front, size_t *front_size, int *w, int *h, int *n,
+    grid_rect *rects
+) {
+  pthread_mutex_lock(&ctx->mtx);
+  *w = ctx->grid_w;
+  *h = ctx->grid_h;
+  *n = ctx->n;
+  size_t size = (size_t)ctx->grid_w * ctx->grid_h;
+  if (size != *front_size) {
+    free(*front);
+    *front = safe_alloc(size);
+    *front_size = size;
+    ctx->nbr_dirty = -1;
+  }
+
+  int nbr_rects = ctx->nbr_dirty;
+  if (nbr_rects < 0) {
+    memcpy(*front, ctx->grid, size);
+  } else {
+    for (int i = 0; i < nbr_rects; ++i) {
+      const grid_rect *r = &ctx->dirty[i];
+      for (int y = r->y; y < r->y + r->h; ++y) {
+	size_t offset = (size_t)y * ctx->grid_w + r->x;
+	memcpy(*front + offset, ctx->grid + offset, r->w);
+      }
+      rects[i] = *r;
+    }
   }
+  ctx->nbr_dirty = 0;
+  pthread_mutex_unlock(&ctx->mtx);
+  return nbr_rects;
 }
 
+// Declares the whole grid exact for the current view and n, e.g. after it
+// was filled from a file
+void set_grid_known(comp_ctx *ctx) {
+  pthread_mutex_lock(&ctx->mtx);
+  memset(ctx->known, KNOWN_EXACT, ctx->grid_len);
+  ctx->nbr_dirty = -1;
+  pthread_mutex_unlock(&ctx->mtx);
+}
+
+void mark_grid_dirty(comp_ctx *ctx) {
+  pthread_mutex_lock(&ctx->mtx);
+  ctx->nbr_dirty = -1;
+  pthread_mutex_unlock(&ctx->mtx);
+}
+
+// Called directly from the pipe thread for every MSG_COMPUTE_DATA, so the
+// chunk state is read under ctx->mtx instead of on the main thread. Data of
+// a generation other than the current one belongs to a view that was left
+// while its chunk was in flight and is dropped.
 void update_data(comp_ctx *ctx, const msg_compute_data *data) {
   assertion(data != NULL, __func__, __LINE__, __FILE__);
+  pthread_mutex_lock(&ctx->mtx);
   debug("RECEIVED: data->cid=%d, ctx->cid=%d", data->cid, ctx->cid);
-  if (data->cid == ctx->cid) {
+  if (!ctx->computing) {
+    debug("Received computed data from module, but not computing");
+  } else if (data->gen != (uint8_t)ctx->gen) {
+    debug("Dropping data of generation %d", data->gen);
+  } else if (data->cid == ctx->cid) {
     int idx = ctx->cur_x + data->i_re + (ctx->cur_y + data->i_im) * ctx->grid_w;
     if (idx >= 0 && idx < (ctx->grid_w * ctx->grid_h)) {
       ctx->grid[idx] = data->iter;
+      ctx->known[idx] = KNOWN_EXACT; // the module keeps no orbit
+    }
+    if ((data->i_re + 1) == ctx->chunk_n_re &&
+        (data->i_im + 1) == ctx->chunk_n_im) {
+      mark_dirty_locked(
+          ctx, ctx->cur_x, ctx->cur_y, ctx->chunk_n_re, ctx->chunk_n_im
+      );
     }
     if ((ctx->cid + 1) >= ctx->nbr_chunks &&
         (data->i_re + 1) == ctx->chunk_n_re &&
@@ -149,25 +378,144 @@ void update_data(comp_ctx *ctx, const msg_compute_data *data) {
       ctx->computing = false;
     }
   } else {
-    error("Received chunk with unexpected chunk id (cid): %d", ctx->cid);
+    error("Received chunk with unexpected chunk id (cid): %d", data->cid);
   }
+  pthread_mutex_unlock(&ctx->mtx);
 }
 
 void clear_grid(comp_ctx *ctx) {
+  pthread_mutex_lock(&ctx->mtx);
   if (ctx->grid) {
     memset(ctx->grid, 0, ctx->grid_w * ctx->grid_h);
+    memset(ctx->known, 0, ctx->grid_w * ctx->grid_h);
+  }
+  ctx->nbr_dirty = -1;
+  ctx->gen++;
+  pthread_mutex_unlock(&ctx->mtx);
+}
+
+// Caller holds ctx->mtx. Moves the cells (of size bytes each) of a w*h
+// buffer so that new (x, y) holds old (x + dx, y + dy), cells with no old
+// counterpart are zeroed.
+static void
+shift_cells(void *cells, size_t size, int w, int h, int dx, int dy) {
+  size_t row_len = (w - abs(dx)) * size;
+  size_t src_x = (dx > 0 ? dx : 0) * size;
+  size_t dst_x = (dx > 0 ? 0 : -dx) * size;
+  size_t pitch = w * size;
+  for (int i = 0; i < h; ++i) {
+    int y = dy > 0 ? i : h - 1 - i; // never read a row already overwritten
+    uint8_t *row = (uint8_t *)cells + y * pitch;
+    if (y + dy < 0 || y + dy >= h || abs(dx) >= w) {
+      memset(row, 0, pitch);
+      continue;
+    }
+    memmove(row + dst_x, (uint8_t *)cells + (y + dy) * pitch + src_x, row_len);
+    memset(dx > 0 ? row + row_len : row, 0, abs(dx) * size);
   }
 }
 
+// Reuses the overlapping part of the grid after the view was moved by whole
+// pixels; only the newly exposed strips are left unknown.
+void shift_grid(comp_ctx *ctx, int dx, int dy) {
+  pthread_mutex_lock(&ctx->mtx);
+  if (abs(dx) >= ctx->grid_w || abs(dy) >= ctx->grid_h) {
+    memset(ctx->known, 0, ctx->grid_len);
+  } else {
+    int w = ctx->grid_w, h = ctx->grid_h;
+    shift_cells(ctx->grid, 1, w, h, dx, dy);
+    shift_cells(ctx->known, 1, w, h, dx, dy);
+    shift_cells(ctx->orbit, sizeof(orbit_z), w, h, dx, dy);
+  }
+  ctx->nbr_dirty = -1;
+  ctx->gen++;
+  pthread_mutex_unlock(&ctx->mtx);
+}
+
 int get_current_cid(comp_ctx *ctx) { return ctx->cid; }
 
 void reset_cid(comp_ctx *ctx) {
-  ctx->cid = 0;
-  ctx->cur_x = 0;
-  ctx->cur_y = 0;
-  ctx->chunk_re = ctx->range_re_min;
-  ctx->chunk_im = ctx->range_im_max;
+  pthread_mutex_lock(&ctx->mtx);
+  rewind_chunks(ctx);
   ctx->computing = false;
+  pthread_mutex_unlock(&ctx->mtx);
 }
 
 uint8_t *get_internal_grid(comp_ctx *ctx) { return ctx->grid; }
+
+// Copies the view parameters and the grid state into job, reusing its
+// buffers when the size did not change
+void local_job_snapshot(comp_ctx *ctx, local_job *job) {
+  pthread_mutex_lock(&ctx->mtx);
+  size_t len = (size_t)ctx->grid_w * ctx->grid_h;
+  if (len != job->len) {
+    local_job_free(job);
+    job->grid = safe_alloc(len);
+    job->known = safe_alloc(len);
+    job->orbit = safe_alloc(len * sizeof(orbit_z));
+    job->len = len;
+  }
+  job->gen = ctx->gen;
+  job->w = ctx->grid_w;
+  job->h = ctx->grid_h;
+  job->n = ctx->n;
+  job->c_re = ctx->c_re;
+  job->c_im = ctx->c_im;
+  job->re_min = ctx->range_re_min;
+  job->im_max = ctx->range_im_max;
+  job->d_re = ctx->d_re;
+  job->d_im = ctx->d_im;
+  memcpy(job->grid, ctx->grid, len);
+  memcpy(job->known, ctx->known, len);
+  memcpy(job->orbit, ctx->orbit, len * sizeof(orbit_z));
+  pthread_mutex_unlock(&ctx->mtx);
+}
+
+bool local_job_is_current(comp_ctx *ctx, const local_job *job) {
+  pthread_mutex_lock(&ctx->mtx);
+  bool current = job->gen == ctx->gen;
+  pthread_mutex_unlock(&ctx->mtx);
+  return current;
+}
+
+// Swaps the job results into the grid unless the view changed meanwhile.
+// Pixels the module delivered in the meantime are kept.
+bool local_job_publish(comp_ctx *ctx, const local_job *job) {
+  pthread_mutex_lock(&ctx->mtx);
+  bool current = job->gen == ctx->gen;
+  if (current) {
+    for (size_t i = 0; i < job->len; ++i) {
+      if (ctx->known[i] & KNOWN_EXACT)
+	continue;
+      ctx->grid[i] = job->grid[i];
+      ctx->known[i] = job->known[i];
+      ctx->orbit[i] = job->orbit[i];
+    }
+    ctx->nbr_dirty = -1;
+  }
+  pthread_mutex_unlock(&ctx->mtx);
+  return current;
+}
+
+void local_job_free(local_job *job) {
+  free(job->grid);
+  free(job->known);
+  free(job->orbit);
+  *job = (local_job){0};
+}
+
+// Iterates z from iteration k on and leaves it at the last iterate
+uint8_t iterate_orbit(
+    double c_re, double c_im, orbit_z *z, uint8_t k, uint8_t max_iter
+) {
+  double z_re = z->re, z_im = z->im;
+  while (k < max_iter && z_re * z_re + z_im * z_im < 4.0) {
+    double tmp = z_re * z_re - z_im * z_im + c_re;
+    z_im = 2 * z_re * z_im + c_im;
+    z_re = tmp;
+    k++;
+  }
+  z->re = z_re;
+  z->im = z_im;
+  return k;
+}
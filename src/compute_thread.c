@@ -0,0 +1,108 @@
+#include "compute_thread.h"
+#include "computation.h"
+#include "render_thread.h"
+#include "window_thread.h"
+
+#include <pthread.h>
+#include <time.h>
+
+static pthread_mutex_t compute_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compute_cond = PTHREAD_COND_INITIALIZER;
+static bool compute_pending = false;
+
+// Requests a local computation of the current view, requests made while one
+// is running collapse into a single follow-up job
+void compute_request_local(void) {
+  pthread_mutex_lock(&compute_mtx);
+  compute_pending = true;
+  pthread_cond_signal(&compute_cond);
+  pthread_mutex_unlock(&compute_mtx);
+}
+
+// Waits until a computation is requested, returns false on quit
+static bool wait_for_request(void) {
+  pthread_mutex_lock(&compute_mtx);
+  while (!compute_pending && !is_quit()) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += COMPUTE_WAIT_TIMEOUT_MS * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&compute_cond, &compute_mtx, &ts);
+  }
+  compute_pending = false;
+  pthread_mutex_unlock(&compute_mtx);
+  return !is_quit();
+}
+
+// Renders coarse-to-fine: every PREVIEW_MAX_STEP-th pixel as a block first,
+// then each finer pass only adds the samples between the already known
+// ones. Each pass is published if the view is still the same, otherwise
+// the job is given up between rows. Returns true when it ran to the end.
+static bool run_job(comp_ctx *ctx, local_job *job) {
+  int w = job->w, h = job->h;
+  for (int step = PREVIEW_MAX_STEP; step >= 1; step /= 2) {
+    for (int y = 0; y < h; y += step) {
+      if (is_quit() || !local_job_is_current(ctx, job))
+	return false;
+      int block_h = y + step <= h ? step : h - y;
+      for (int x = 0; x < w; x += step) {
+	size_t idx = (size_t)y * w + x;
+	if (!(job->known[idx] & KNOWN_EXACT)) {
+	  // resume a kept orbit after n was raised, else start at the pixel
+	  orbit_z *z = &job->orbit[idx];
+	  uint8_t k = job->grid[idx];
+	  if (!(job->known[idx] & KNOWN_ORBIT)) {
+	    z->re = job->re_min + x * job->d_re;
+	    z->im = job->im_max + y * job->d_im;
+	    k = 0;
+	  }
+	  job->grid[idx] = iterate_orbit(job->c_re, job->c_im, z, k, job->n);
+	  job->known[idx] = KNOWN_EXACT;
+	  if (job->grid[idx] == job->n)
+	    job->known[idx] |= KNOWN_ORBIT;
+	}
+	if (step == 1)
+	  continue;
+	// preview block, pixels known or resumable from before are kept
+	int block_w = x + step <= w ? step : w - x;
+	for (int by = 0; by < block_h; ++by) {
+	  for (int bx = 0; bx < block_w; ++bx) {
+	    size_t i = idx + (size_t)by * w + bx;
+	    if (!job->known[i])
+	      job->grid[i] = job->grid[idx];
+	  }
+	}
+      }
+    }
+    if (!local_job_publish(ctx, job))
+      return false;
+    render_request_redraw();
+  }
+  return true;
+}
+
+// Computes the view locally off the event loop. A job works on a private
+// copy of the grid, so a view change only has to bump ctx->gen to make the
+// running job stop and the pending request start over on the new view.
+void *compute_thread(void *arg) {
+  comp_ctx *ctx = arg;
+  local_job job = {0};
+  debug("compute_thread - start");
+  while (wait_for_request()) {
+    info("Local computation on PC started");
+    local_job_snapshot(ctx, &job);
+    if (run_job(ctx, &job)) {
+      info("Local computation done");
+      xwin_set_overlay_message("Locally computed");
+      render_request_redraw();
+    } else {
+      info("Local computation cancelled, view changed");
+    }
+  }
+  local_job_free(&job);
+  debug("compute_thread - stop");
+  return NULL;
+}
@@ -1,9 +1,12 @@
 #include "ffmpeg_writer.h"
+#include "common.h"
+
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
 #include <libswscale/swscale.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -17,8 +20,10 @@ struct ffmpeg_writer {
   int frame_index;
 };
 
-ffmpeg_writer *
-ffmpeg_writer_create(const char *filename, int width, int height, int fps) {
+ffmpeg_writer *ffmpeg_writer_create(
+    const char *filename, int width, int height, int fps,
+    const ffmpeg_profile *profile
+) {
   ffmpeg_writer *w = calloc(1, sizeof(ffmpeg_writer));
   if (!w)
     return NULL;
@@ -28,12 +33,23 @@ ffmpeg_writer_create(const char *filename, int width, int height, int fps) {
   w->frame_index = 0;
 
   avformat_alloc_output_context2(&w->fmt_ctx, NULL, NULL, filename);
-  if (!w->fmt_ctx)
+  if (!w->fmt_ctx) {
+    error("Unknown video container for %s", filename);
     return NULL;
+  }
 
-  const AVCodec *codec = avcodec_find_encoder(VIDEO_CODEC);
-  if (!codec)
+  const char *name = profile->codec ? profile->codec : VIDEO_CODEC;
+  const AVCodec *codec = avcodec_find_encoder_by_name(name);
+  if (!codec) {
+    error("Video encoder %s is not available", name);
+    return NULL;
+  }
+  if (avformat_query_codec(
+          w->fmt_ctx->oformat, codec->id, FF_COMPLIANCE_NORMAL
+      ) == 0) {
+    error("%s cannot be stored in %s", name, w->fmt_ctx->oformat->name);
     return NULL;
+  }
 
   w->stream = avformat_new_stream(w->fmt_ctx, NULL);
   if (!w->stream)
@@ -44,25 +60,45 @@ ffmpeg_writer_create(const char *filename, int width, int height, int fps) {
   if (!w->codec_ctx)
     return NULL;
 
+  // GOP and B-frames are left to the encoder, its defaults compress better,
+  // unless segments have to be cut at GOP boundaries
   w->codec_ctx->codec_id = codec->id;
-  w->codec_ctx->bit_rate = VIDEO_BITRATE;
   w->codec_ctx->width = width;
   w->codec_ctx->height = height;
   w->codec_ctx->time_base = (AVRational){1, fps};
   w->codec_ctx->framerate = (AVRational){fps, 1};
-  w->codec_ctx->gop_size = 10;
-  w->codec_ctx->max_b_frames = 1;
-  w->codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  w->codec_ctx->pix_fmt = codec->id == AV_CODEC_ID_FFV1 ? AV_PIX_FMT_YUV444P
+                                                        : AV_PIX_FMT_YUV420P;
+  w->codec_ctx->thread_count = profile->threads;
+  w->codec_ctx->thread_type = profile->thread_type
+                                  ? profile->thread_type
+                                  : FF_THREAD_FRAME | FF_THREAD_SLICE;
+  if (codec->id == AV_CODEC_ID_FFV1)
+    w->codec_ctx->level = 3; // needed for slices, which ffv1 threads over
+  if (profile->gop > 0) {
+    w->codec_ctx->gop_size = profile->gop;
+    w->codec_ctx->keyint_min = profile->gop;
+    w->codec_ctx->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+  }
 
-  av_opt_set(w->codec_ctx->priv_data, "crf", VIDEO_CFR, 0);
+  int crf = profile->crf >= 0 ? profile->crf : VIDEO_CFR;
+  if (av_opt_set_int(w->codec_ctx->priv_data, "crf", crf, 0) < 0)
+    w->codec_ctx->bit_rate = VIDEO_BITRATE;
+  if (profile->preset &&
+      av_opt_set(w->codec_ctx->priv_data, "preset", profile->preset, 0) < 0) {
+    error("%s has no presets", name);
+    return NULL;
+  }
 
   if (w->fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
     w->codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 
   w->stream->time_base = w->codec_ctx->time_base;
 
-  if (avcodec_open2(w->codec_ctx, codec, NULL) < 0)
+  if (avcodec_open2(w->codec_ctx, codec, NULL) < 0) {
+    error("Failed to open %s with the given settings", name);
     return NULL;
+  }
 
   if (avcodec_parameters_from_context(w->stream->codecpar, w->codec_ctx) < 0)
     return NULL;
@@ -85,25 +121,11 @@ ffmpeg_writer_create(const char *filename, int width, int height, int fps) {
   if (av_frame_get_buffer(w->frame, 32) < 0)
     return NULL;
 
-  w->sws_ctx = sws_getContext(
-      width, height, AV_PIX_FMT_RGB24, width, height, AV_PIX_FMT_YUV420P,
-      SWS_BICUBIC, NULL, NULL, NULL
-  );
-  if (!w->sws_ctx)
-    return NULL;
-
   return w;
 }
 
-void ffmpeg_writer_add_frame(ffmpeg_writer *w, uint8_t *rgb_data) {
-  const uint8_t *src_slice[1] = {rgb_data};
-  int src_stride[1] = {3 * w->width};
-
-  sws_scale(
-      w->sws_ctx, src_slice, src_stride, 0, w->height, w->frame->data,
-      w->frame->linesize
-  );
-
+// Encodes w->frame and writes out the packets the encoder has ready
+static void encode_frame(ffmpeg_writer *w) {
   w->frame->pts = w->frame_index++;
 
   AVPacket *pkt = av_packet_alloc();
@@ -132,6 +154,56 @@ void ffmpeg_writer_add_frame(ffmpeg_writer *w, uint8_t *rgb_data) {
   av_packet_free(&pkt);
 }
 
+void ffmpeg_writer_add_frame(ffmpeg_writer *w, uint8_t *rgb_data) {
+  if (!w->sws_ctx) {
+    // only needed for RGB input, see ffmpeg_writer_add_grid()
+    w->sws_ctx = sws_getContext(
+        w->width, w->height, AV_PIX_FMT_RGB24, w->width, w->height,
+        w->codec_ctx->pix_fmt, SWS_BICUBIC, NULL, NULL, NULL
+    );
+    if (!w->sws_ctx)
+      return;
+  }
+  if (av_frame_make_writable(w->frame) < 0)
+    return;
+
+  const uint8_t *src_slice[1] = {rgb_data};
+  int src_stride[1] = {3 * w->width};
+
+  sws_scale(
+      w->sws_ctx, src_slice, src_stride, 0, w->height, w->frame->data,
+      w->frame->linesize
+  );
+  encode_frame(w);
+}
+
+// Colours the iteration grid straight into the YUV planes through the
+// palette's YCbCr table
+void ffmpeg_writer_add_grid(
+    ffmpeg_writer *w, const uint8_t *grid, const palette *pal
+) {
+  if (av_frame_make_writable(w->frame) < 0)
+    return;
+  AVFrame *f = w->frame;
+
+  if (f->format == AV_PIX_FMT_YUV444P) {
+    for (int y = 0; y < w->height; ++y) {
+      const uint8_t *src = grid + (size_t)y * w->width;
+      uint8_t *luma = f->data[0] + (size_t)y * f->linesize[0];
+      uint8_t *cb = f->data[1] + (size_t)y * f->linesize[1];
+      uint8_t *cr = f->data[2] + (size_t)y * f->linesize[2];
+      for (int x = 0; x < w->width; ++x) {
+	luma[x] = pal->yuv[src[x]][0];
+	cb[x] = pal->yuv[src[x]][1];
+	cr[x] = pal->yuv[src[x]][2];
+      }
+    }
+  } else {
+    palette_apply_yuv420(pal, grid, w->width, w->height, f->data, f->linesize);
+  }
+  encode_frame(w);
+}
+
 void ffmpeg_writer_close(ffmpeg_writer *w) {
   if (!w)
     return;
@@ -157,3 +229,109 @@ void ffmpeg_writer_close(ffmpeg_writer *w) {
   avformat_free_context(w->fmt_ctx);
   free(w);
 }
+
+// Adds the packets of the video stream of one segment to out, behind those
+// before it, *end becomes where the segment ends in the time base of ost
+static bool concat_segment(
+    AVFormatContext *out, AVStream **ost, const char *segment, int64_t *end
+) {
+  AVFormatContext *in = NULL;
+  if (avformat_open_input(&in, segment, NULL, NULL) < 0 ||
+      avformat_find_stream_info(in, NULL) < 0) {
+    error("Failed to read %s", segment);
+    avformat_close_input(&in);
+    return false;
+  }
+  int index = av_find_best_stream(in, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+  if (index < 0) {
+    error("%s has no video stream", segment);
+    avformat_close_input(&in);
+    return false;
+  }
+  AVStream *ist = in->streams[index];
+
+  if (!*ost) {
+    // the first segment sets up the output
+    *ost = avformat_new_stream(out, NULL);
+    if (!*ost ||
+        avcodec_parameters_copy((*ost)->codecpar, ist->codecpar) < 0) {
+      avformat_close_input(&in);
+      return false;
+    }
+    (*ost)->codecpar->codec_tag = 0; // let the muxer pick its own
+    (*ost)->time_base = ist->time_base;
+    if (!(out->oformat->flags & AVFMT_NOFILE) &&
+        avio_open(&out->pb, out->url, AVIO_FLAG_WRITE) < 0) {
+      error("Failed to open %s", out->url);
+      avformat_close_input(&in);
+      return false;
+    }
+    if (avformat_write_header(out, NULL) < 0) {
+      avformat_close_input(&in);
+      return false;
+    }
+  } else if (ist->codecpar->codec_id != (*ost)->codecpar->codec_id ||
+             ist->codecpar->width != (*ost)->codecpar->width ||
+             ist->codecpar->height != (*ost)->codecpar->height) {
+    error("%s is not encoded like the first segment", segment);
+    avformat_close_input(&in);
+    return false;
+  }
+
+  // a frame lasts this long when the container does not store it
+  AVRational rate = ist->avg_frame_rate.num > 0 ? ist->avg_frame_rate
+                                                : ist->r_frame_rate;
+  int64_t frame_duration =
+      rate.num > 0 ? av_rescale_q(1, av_inv_q(rate), (*ost)->time_base) : 1;
+  int64_t offset = *end;
+  bool ok = true;
+  AVPacket *pkt = av_packet_alloc();
+  while (ok && pkt && av_read_frame(in, pkt) >= 0) {
+    if (pkt->stream_index == index) {
+      av_packet_rescale_ts(pkt, ist->time_base, (*ost)->time_base);
+      if (pkt->pts != AV_NOPTS_VALUE)
+	pkt->pts += offset;
+      if (pkt->dts != AV_NOPTS_VALUE)
+	pkt->dts += offset;
+      int64_t pkt_end = (pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts) +
+                        (pkt->duration > 0 ? pkt->duration : frame_duration);
+      *end = pkt_end > *end ? pkt_end : *end;
+      pkt->stream_index = (*ost)->index;
+      pkt->pos = -1;
+      ok = av_interleaved_write_frame(out, pkt) >= 0;
+    }
+    av_packet_unref(pkt);
+  }
+  av_packet_free(&pkt);
+  avformat_close_input(&in);
+  if (!ok)
+    error("Failed to write the packets of %s", segment);
+  return ok;
+}
+
+bool ffmpeg_concat(
+    const char *filename, char *const *segments, int nbr_segments
+) {
+  AVFormatContext *out = NULL;
+  avformat_alloc_output_context2(&out, NULL, NULL, filename);
+  if (!out) {
+    error("Unknown video container for %s", filename);
+    return false;
+  }
+
+  AVStream *ost = NULL;
+  int64_t end = 0;
+  bool ok = true;
+  for (int i = 0; i < nbr_segments && ok; ++i) {
+    ok = concat_segment(out, &ost, segments[i], &end);
+  }
+  if (ost && av_write_trailer(out) < 0)
+    ok = false;
+
+  if (out->pb && !(out->oformat->flags & AVFMT_NOFILE))
+    avio_closep(&out->pb);
+  avformat_free_context(out);
+  if (!ok && ost)
+    remove(filename);
+  return ok;
+}
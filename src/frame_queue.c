@@ -0,0 +1,111 @@
+#include "frame_queue.h"
+#include "common.h"
+
+#include <stdlib.h>
+
+frame_queue *frame_queue_create(size_t frame_size, int depth, int nbr_frames) {
+  if (depth < 1)
+    return NULL;
+  frame_queue *fq = safe_alloc(sizeof(frame_queue));
+  *fq = (frame_queue){
+      .depth = depth, .nbr_free = depth, .nbr_frames = nbr_frames
+  };
+  fq->pool = safe_alloc(depth * sizeof(uint8_t *));
+  fq->free = safe_alloc(depth * sizeof(uint8_t *));
+  fq->ready = safe_alloc(depth * sizeof(uint8_t *));
+  for (int i = 0; i < depth; ++i) {
+    fq->pool[i] = safe_alloc(frame_size);
+    fq->free[i] = fq->pool[i];
+    fq->ready[i] = NULL;
+  }
+  pthread_mutex_init(&fq->mtx, NULL);
+  pthread_cond_init(&fq->cond, NULL);
+  return fq;
+}
+
+void frame_queue_destroy(frame_queue *fq) {
+  if (!fq)
+    return;
+  for (int i = 0; i < fq->depth; ++i) {
+    free(fq->pool[i]);
+  }
+  free(fq->pool);
+  free(fq->free);
+  free(fq->ready);
+  pthread_mutex_destroy(&fq->mtx);
+  pthread_cond_destroy(&fq->cond);
+  free(fq);
+}
+
+// Blocks until a pooled buffer is free and hands it out with the index of
+// the frame to render into it. Returns NULL when all frames were handed out
+// or the queue was closed. Taking both at once keeps the frames in flight
+// consecutive, so the one the consumer waits for always has a buffer.
+uint8_t *frame_queue_acquire(frame_queue *fq, int *index) {
+  pthread_mutex_lock(&fq->mtx);
+  while (fq->nbr_free == 0 && !fq->closed) {
+    pthread_cond_wait(&fq->cond, &fq->mtx);
+  }
+  uint8_t *frame = NULL;
+  if (!fq->closed && fq->next_index < fq->nbr_frames) {
+    frame = fq->free[--fq->nbr_free];
+    *index = fq->next_index++;
+  }
+  pthread_mutex_unlock(&fq->mtx);
+  return frame;
+}
+
+void frame_queue_submit(frame_queue *fq, uint8_t *frame, int index) {
+  pthread_mutex_lock(&fq->mtx);
+  fq->ready[index % fq->depth] = frame;
+  pthread_cond_broadcast(&fq->cond);
+  pthread_mutex_unlock(&fq->mtx);
+}
+
+// Stops handing out frames, those already handed out are still popped
+void frame_queue_close(frame_queue *fq) {
+  pthread_mutex_lock(&fq->mtx);
+  fq->closed = true;
+  pthread_cond_broadcast(&fq->cond);
+  pthread_mutex_unlock(&fq->mtx);
+}
+
+// Hands out frames only up to the next multiple of align (or the last one),
+// so that the frames popped end on such a boundary
+void frame_queue_stop_at(frame_queue *fq, int align) {
+  pthread_mutex_lock(&fq->mtx);
+  int stop = (fq->next_index + align - 1) / align * align;
+  if (stop < fq->nbr_frames)
+    fq->nbr_frames = stop;
+  pthread_cond_broadcast(&fq->cond);
+  pthread_mutex_unlock(&fq->mtx);
+}
+
+// Returns the next frame in index order, or NULL once no more will come
+uint8_t *frame_queue_pop(frame_queue *fq) {
+  pthread_mutex_lock(&fq->mtx);
+  uint8_t *frame = NULL;
+  while (true) {
+    bool more = fq->next_pop < fq->next_index ||
+                (!fq->closed && fq->next_index < fq->nbr_frames);
+    if (!more)
+      break;
+    int slot = fq->next_pop % fq->depth;
+    if (fq->ready[slot]) {
+      frame = fq->ready[slot];
+      fq->ready[slot] = NULL;
+      fq->next_pop++;
+      break;
+    }
+    pthread_cond_wait(&fq->cond, &fq->mtx);
+  }
+  pthread_mutex_unlock(&fq->mtx);
+  return frame;
+}
+
+void frame_queue_release(frame_queue *fq, uint8_t *frame) {
+  pthread_mutex_lock(&fq->mtx);
+  fq->free[fq->nbr_free++] = frame;
+  pthread_cond_broadcast(&fq->cond);
+  pthread_mutex_unlock(&fq->mtx);
+}
@@ -0,0 +1,100 @@
+#include "frame_stream.h"
+#include "common.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+frame_stream *frame_stream_create(
+    const char *path, int w, int h, int fps, frame_stream_format format
+) {
+  frame_stream *s = safe_alloc(sizeof(frame_stream));
+  *s = (frame_stream){.format = format, .w = w, .h = h};
+  if (strcmp(path, FRAME_STREAM_STDOUT) == 0) {
+    s->fd = STDOUT_FILENO;
+  } else {
+    // blocks until a reader opens a FIFO
+    s->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    s->close_fd = true;
+  }
+  if (s->fd < 0) {
+    error("Failed to open %s", path);
+    free(s);
+    return NULL;
+  }
+
+  if (format == FRAME_STREAM_Y4M) {
+    s->frame_size = (size_t)w * h + 2 * (size_t)((w + 1) / 2) * ((h + 1) / 2);
+    s->header_len = snprintf(
+        s->header, sizeof(s->header),
+        "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", w,
+        h, fps
+    );
+  } else {
+    s->frame_size = (size_t)w * h * 3;
+  }
+  s->buf = safe_alloc(s->frame_size);
+  return s;
+}
+
+// Writes buf as the next frame, behind the stream header the first time
+static bool write_frame(frame_stream *s, const uint8_t *data) {
+  static char frame_tag[] = "FRAME\n";
+  struct iovec iov[3];
+  int cnt = 0;
+  if (s->header_len)
+    iov[cnt++] = (struct iovec){s->header, s->header_len};
+  if (s->format == FRAME_STREAM_Y4M)
+    iov[cnt++] = (struct iovec){frame_tag, sizeof(frame_tag) - 1};
+  iov[cnt++] = (struct iovec){(void *)data, s->frame_size};
+  s->header_len = 0;
+  return write_all(s->fd, iov, cnt);
+}
+
+// Plane pointers into a Y4M frame buffer
+static void y4m_planes(frame_stream *s, uint8_t *planes[3], int linesize[3]) {
+  int cw = (s->w + 1) / 2, ch = (s->h + 1) / 2;
+  planes[0] = s->buf;
+  planes[1] = planes[0] + (size_t)s->w * s->h;
+  planes[2] = planes[1] + (size_t)cw * ch;
+  linesize[0] = s->w;
+  linesize[1] = linesize[2] = cw;
+}
+
+bool frame_stream_add_grid(
+    frame_stream *s, const uint8_t *grid, const palette *pal
+) {
+  if (s->format == FRAME_STREAM_Y4M) {
+    uint8_t *planes[3];
+    int linesize[3];
+    y4m_planes(s, planes, linesize);
+    palette_apply_yuv420(pal, grid, s->w, s->h, planes, linesize);
+  } else {
+    palette_apply(pal, grid, (size_t)s->w * s->h, s->buf);
+  }
+  return write_frame(s, s->buf);
+}
+
+bool frame_stream_add_frame(frame_stream *s, const uint8_t *rgb) {
+  if (s->format == FRAME_STREAM_RGB)
+    return write_frame(s, rgb);
+
+  uint8_t *planes[3];
+  int linesize[3];
+  y4m_planes(s, planes, linesize);
+  rgb_to_yuv420(rgb, s->w, s->h, planes, linesize);
+  return write_frame(s, s->buf);
+}
+
+bool frame_stream_close(frame_stream *s) {
+  if (!s)
+    return false;
+
+  bool ok = !s->close_fd || close(s->fd) == 0;
+  free(s->buf);
+  free(s);
+  return ok;
+}
@@ -0,0 +1,125 @@
+#include "grid_file.h"
+#include "common.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Size of the version 1 header, without the tile fields
+#define GRID_FILE_HEADER_V1 offsetof(grid_file_header, tile_w)
+#define GRID_FILE_SIDE_MAX (1 << 24) // Keeps the size computations in range
+
+static size_t tiles_size(const grid_file_header *h) {
+  size_t tiles_x = ((size_t)h->w + h->tile_w - 1) / h->tile_w;
+  size_t tiles_y = ((size_t)h->h + h->tile_h - 1) / h->tile_h;
+  return tiles_x * tiles_y * h->tile_w * h->tile_h;
+}
+
+// Checks what the header promises against the file size
+static bool header_valid(grid_file_header *h, size_t file_size) {
+  if (file_size < GRID_FILE_HEADER_V1 ||
+      memcmp(h->magic, GRID_FILE_MAGIC, sizeof(h->magic)) != 0) {
+    error("Not a grid file");
+    return false;
+  }
+  if (h->version == 1) {
+    h->tile_w = h->w;
+    h->tile_h = h->h;
+  } else if (h->version != GRID_FILE_VERSION ||
+             file_size < sizeof(grid_file_header)) {
+    error("Unsupported grid file version %u", h->version);
+    return false;
+  }
+  if (h->w == 0 || h->h == 0 || h->tile_w == 0 || h->tile_h == 0 ||
+      h->w > GRID_FILE_SIDE_MAX || h->h > GRID_FILE_SIDE_MAX ||
+      h->tile_w > GRID_FILE_SIDE_MAX || h->tile_h > GRID_FILE_SIDE_MAX ||
+      h->n > UINT8_MAX || h->header_size > file_size ||
+      tiles_size(h) > file_size - h->header_size) {
+    error("Corrupted or truncated grid file");
+    return false;
+  }
+  return true;
+}
+
+grid_file *grid_file_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    error("Failed to open %s", path);
+    return NULL;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // the mapping stays valid
+  if (map == MAP_FAILED) {
+    error("Failed to map %s", path);
+    return NULL;
+  }
+
+  grid_file *g = safe_alloc(sizeof(grid_file));
+  *g = (grid_file){.map = map, .map_size = st.st_size};
+  memcpy(
+      &g->header, map,
+      g->map_size < sizeof(g->header) ? g->map_size : sizeof(g->header)
+  );
+  if (!header_valid(&g->header, g->map_size)) {
+    grid_file_close(g);
+    return NULL;
+  }
+  g->data = (const uint8_t *)map + g->header.header_size;
+  madvise(map, g->map_size, MADV_SEQUENTIAL);
+  return g;
+}
+
+void grid_file_close(grid_file *g) {
+  if (!g)
+    return;
+  munmap(g->map, g->map_size);
+  free(g);
+}
+
+void grid_file_read(const grid_file *g, uint8_t *dst) {
+  grid_file_read_rows(g, 0, g->header.h, dst);
+}
+
+void grid_file_read_rows(const grid_file *g, int y0, int count, uint8_t *dst) {
+  const grid_file_header *h = &g->header;
+  size_t tile_size = (size_t)h->tile_w * h->tile_h;
+  size_t tiles_x = (h->w + h->tile_w - 1) / h->tile_w;
+  for (uint32_t y = y0; y < (uint32_t)(y0 + count); ++y) {
+    const uint8_t *tile_row =
+        g->data + (y / h->tile_h) * tiles_x * tile_size +
+        (size_t)(y % h->tile_h) * h->tile_w;
+    for (uint32_t x = 0; x < h->w; x += h->tile_w) {
+      size_t len = h->w - x < h->tile_w ? h->w - x : h->tile_w;
+      memcpy(
+          dst + (size_t)(y - y0) * h->w + x,
+          tile_row + x / h->tile_w * tile_size, len
+      );
+    }
+  }
+}
+
+size_t grid_file_tile_rows(
+    const grid_file_header *header, const uint8_t *rows, int count,
+    uint8_t *tiles
+) {
+  const grid_file_header *h = header;
+  size_t tile_size = (size_t)h->tile_w * h->tile_h;
+  size_t tiles_x = (h->w + h->tile_w - 1) / h->tile_w;
+  memset(tiles, 0, tiles_x * tile_size); // padding of edge tiles
+  for (int y = 0; y < count; ++y) {
+    for (uint32_t x = 0; x < h->w; x += h->tile_w) {
+      size_t len = h->w - x < h->tile_w ? h->w - x : h->tile_w;
+      memcpy(
+          tiles + x / h->tile_w * tile_size + (size_t)y * h->tile_w,
+          rows + (size_t)y * h->w + x, len
+      );
+    }
+  }
+  return tiles_x * tile_size;
+}
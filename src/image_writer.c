@@ -1,68 +1,362 @@
-#include <png.h>
+#include "image_writer.h"
+#include "common.h"
+
 #include <jpeglib.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 
-bool save_image_png(const char *path, uint8_t *image, int w, int h) {
-  FILE *fp = fopen(path, "wb");
-  if (!fp)
-    return false;
+#define JPEG_QUALITY 95
+#define IMAGE_HEADER_MAX GRID_FILE_DATA_OFFSET // Longest raw format header
 
-  png_structp png_ptr =
-      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if (!png_ptr)
-    return false;
-  png_infop info_ptr = png_create_info_struct(png_ptr);
-  if (!info_ptr)
-    return false;
-  if (setjmp(png_jmpbuf(png_ptr)))
-    return false;
+typedef enum {
+  IMAGE_PNG,
+  IMAGE_JPEG,
+  IMAGE_PPM,
+  IMAGE_PAM,
+  IMAGE_QOI,
+  IMAGE_RGB,
+  IMAGE_GRID
+} image_format;
+
+// QOI encoder state, carried over from one write to the next
+typedef struct {
+  uint32_t index[64]; // Recently seen pixels by hash, 0 = empty
+  uint32_t prev;      // Previous pixel as r | g << 8 | b << 16 | a << 24
+  int run;            // Repeats of prev not written yet
+} qoi_state;
+
+struct image_stream {
+  FILE *fp;
+  image_format format;
+  int w, h;
+  int y;       // Rows written so far
+  bool failed; // An encoder error happened, the file is not finished
+  png_writer *png;
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  uint8_t header[IMAGE_HEADER_MAX]; // Sent along with the first rows
+  size_t header_len;
+  qoi_state qoi;
+  uint8_t *qoi_out;
+  size_t qoi_cap;
+  grid_file_header grid;
+  uint8_t *grid_rows;  // Rows of the tile row being collected
+  int nbr_grid_rows;   // How many
+  uint8_t *grid_tiles; // The same rows tiled
+};
 
-  png_init_io(png_ptr, fp);
-  png_set_IHDR(
-      png_ptr, info_ptr, w, h, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-      PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
-  );
-  png_write_info(png_ptr, info_ptr);
+static const struct {
+  const char *ext;
+  image_format format;
+} image_extensions[] = {
+    {".png", IMAGE_PNG},  {".jpg", IMAGE_JPEG}, {".jpeg", IMAGE_JPEG},
+    {".ppm", IMAGE_PPM},  {".pam", IMAGE_PAM},  {".qoi", IMAGE_QOI},
+    {".rgb", IMAGE_RGB},  {".raw", IMAGE_RGB},  {".grid", IMAGE_GRID},
+};
 
-  for (int y = 0; y < h; ++y)
-    png_write_row(png_ptr, image + y * w * 3);
+static bool format_from_path(const char *path, image_format *format) {
+  const char *ext = strrchr(path, '.');
+  size_t nbr = sizeof(image_extensions) / sizeof(image_extensions[0]);
+  for (size_t i = 0; ext && i < nbr; ++i) {
+    if (strcmp(ext, image_extensions[i].ext) == 0) {
+      *format = image_extensions[i].format;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool image_path_is_grid(const char *path) {
+  image_format format;
+  return format_from_path(path, &format) && format == IMAGE_GRID;
+}
+
+static void put_be32(uint8_t *dst, uint32_t v) {
+  dst[0] = v >> 24;
+  dst[1] = v >> 16;
+  dst[2] = v >> 8;
+  dst[3] = v;
+}
+
+// Writes data behind whatever header is still pending, in one writev()
+static bool raw_write(image_stream *s, const uint8_t *data, size_t len) {
+  struct iovec iov[2] = {
+      {.iov_base = s->header, .iov_len = s->header_len},
+      {.iov_base = (void *)data, .iov_len = len}
+  };
+  s->header_len = 0;
+  return write_all(fileno(s->fp), iov, 2);
+}
 
-  png_write_end(png_ptr, NULL);
-  png_destroy_write_struct(&png_ptr, &info_ptr);
-  fclose(fp);
+// Appends the QOI chunks of count pixels to out, and the end marker after
+// the last pixel of the image. Needs at most 4 bytes per pixel plus 8.
+static size_t qoi_encode(
+    qoi_state *q, const uint8_t *px, size_t count, bool last, uint8_t *out
+) {
+  uint8_t *o = out;
+  for (size_t i = 0; i < count; ++i, px += 3) {
+    uint32_t v = px[0] | px[1] << 8 | (uint32_t)px[2] << 16 | 0xffu << 24;
+    if (v == q->prev) {
+      if (++q->run == 62) {
+	*o++ = 0xc0 | (q->run - 1); // QOI_OP_RUN
+	q->run = 0;
+      }
+      continue;
+    }
+    if (q->run > 0) {
+      *o++ = 0xc0 | (q->run - 1);
+      q->run = 0;
+    }
+
+    int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+    if (q->index[hash] == v) {
+      *o++ = hash; // QOI_OP_INDEX
+    } else {
+      q->index[hash] = v;
+      int8_t dr = px[0] - (uint8_t)q->prev;
+      int8_t dg = px[1] - (uint8_t)(q->prev >> 8);
+      int8_t db = px[2] - (uint8_t)(q->prev >> 16);
+      int dr_dg = dr - dg, db_dg = db - dg;
+      if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+	*o++ = 0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2); // QOI_OP_DIFF
+      } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                 db_dg >= -8 && db_dg <= 7) {
+	*o++ = 0x80 | (dg + 32); // QOI_OP_LUMA
+	*o++ = (dr_dg + 8) << 4 | (db_dg + 8);
+      } else {
+	*o++ = 0xfe; // QOI_OP_RGB
+	*o++ = px[0];
+	*o++ = px[1];
+	*o++ = px[2];
+      }
+    }
+    q->prev = v;
+  }
+
+  if (last) {
+    if (q->run > 0)
+      *o++ = 0xc0 | (q->run - 1);
+    static const uint8_t end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    memcpy(o, end, sizeof(end));
+    o += sizeof(end);
+  }
+  return o - out;
+}
+
+static bool qoi_write(image_stream *s, const uint8_t *rows, int count) {
+  size_t pixels = (size_t)count * s->w;
+  if (s->qoi_cap < 4 * pixels + 8) {
+    free(s->qoi_out);
+    s->qoi_cap = 4 * pixels + 8;
+    s->qoi_out = safe_alloc(s->qoi_cap);
+  }
+  bool last = s->y + count == s->h;
+  size_t len = qoi_encode(&s->qoi, rows, pixels, last, s->qoi_out);
+  return raw_write(s, s->qoi_out, len);
+}
+
+// Collects iteration rows until a row of tiles is complete, then writes it
+static bool grid_write(image_stream *s, const uint8_t *rows, int count) {
+  for (int i = 0; i < count; ++i) {
+    uint8_t *dst = s->grid_rows + (size_t)s->nbr_grid_rows++ * s->w;
+    memcpy(dst, rows + (size_t)i * s->w, s->w);
+    if (s->nbr_grid_rows < (int)s->grid.tile_h && s->y + i + 1 < s->h)
+      continue;
+    size_t len = grid_file_tile_rows(
+        &s->grid, s->grid_rows, s->nbr_grid_rows, s->grid_tiles
+    );
+    s->nbr_grid_rows = 0;
+    if (!raw_write(s, s->grid_tiles, len))
+      return false;
+  }
   return true;
 }
 
-bool save_image_jpg(const char *path, uint8_t *image, int w, int h) {
-  FILE *fp = fopen(path, "wb");
-  if (!fp)
+// Prepares the header written in front of the first rows
+static void raw_start(image_stream *s, const grid_file_header *grid) {
+  char *text = (char *)s->header;
+  switch (s->format) {
+  case IMAGE_PPM:
+    s->header_len =
+        snprintf(text, IMAGE_HEADER_MAX, "P6\n%d %d\n255\n", s->w, s->h);
+    break;
+  case IMAGE_PAM:
+    s->header_len = snprintf(
+        text, IMAGE_HEADER_MAX,
+        "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n",
+        s->w, s->h
+    );
+    break;
+  case IMAGE_QOI:
+    memcpy(s->header, "qoif", 4);
+    put_be32(s->header + 4, s->w);
+    put_be32(s->header + 8, s->h);
+    s->header[12] = 3; // RGB
+    s->header[13] = 0; // sRGB
+    s->header_len = 14;
+    s->qoi.prev = 0xffu << 24; // black, opaque
+    break;
+  case IMAGE_GRID: {
+    size_t tiles_x = (s->w + grid->tile_w - 1) / grid->tile_w;
+    s->grid = *grid;
+    s->grid_rows = safe_alloc((size_t)grid->tile_h * s->w);
+    s->grid_tiles = safe_alloc(tiles_x * grid->tile_w * grid->tile_h);
+    memcpy(s->header, grid, sizeof(*grid)); // the rest stays zero
+    s->header_len = grid->header_size;
+    break;
+  }
+  default:
+    s->header_len = 0;
+  }
+}
+
+static bool jpeg_start(image_stream *s) {
+  s->cinfo.err = jpeg_std_error(&s->jerr);
+  jpeg_create_compress(&s->cinfo);
+  jpeg_stdio_dest(&s->cinfo, s->fp);
+
+  s->cinfo.image_width = s->w;
+  s->cinfo.image_height = s->h;
+  s->cinfo.input_components = 3;
+  s->cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&s->cinfo);
+  jpeg_set_quality(&s->cinfo, JPEG_QUALITY, TRUE);
+  jpeg_start_compress(&s->cinfo, TRUE);
+  return true;
+}
+
+static image_stream *stream_open(
+    const char *path, int w, int h, image_format format,
+    const png_options *png, const grid_file_header *grid
+) {
+  if (format == IMAGE_JPEG &&
+      (w > JPEG_MAX_DIMENSION || h > JPEG_MAX_DIMENSION)) {
+    error("JPEG is limited to %ld pixels a side", (long)JPEG_MAX_DIMENSION);
+    return NULL;
+  }
+  image_stream *s = calloc(1, sizeof(image_stream));
+  if (!s)
+    return NULL;
+  s->w = w;
+  s->h = h;
+  s->format = format;
+  s->fp = fopen(path, "wb");
+  if (!s->fp) {
+    free(s);
+    return NULL;
+  }
+
+  bool started = true;
+  if (format == IMAGE_PNG) {
+    s->png = png_writer_create(s->fp, w, h, png);
+    started = s->png != NULL;
+  } else if (format == IMAGE_JPEG) {
+    started = jpeg_start(s);
+  } else {
+    raw_start(s, grid);
+  }
+  if (!started) {
+    s->failed = true;
+    image_stream_close(s);
+    remove(path);
+    return NULL;
+  }
+  return s;
+}
+
+image_stream *
+image_stream_open(const char *path, int w, int h, const png_options *png) {
+  image_format format;
+  if (!format_from_path(path, &format) || format == IMAGE_GRID) {
+    error("Unsupported image format (use " IMAGE_FORMATS ")");
+    return NULL;
+  }
+  return stream_open(path, w, h, format, png, NULL);
+}
+
+image_stream *
+grid_stream_open(const char *path, const grid_file_header *header) {
+  if (header->header_size < sizeof(*header) ||
+      header->header_size > IMAGE_HEADER_MAX) {
+    error("Invalid grid header size %u", header->header_size);
+    return NULL;
+  }
+  return stream_open(path, header->w, header->h, IMAGE_GRID, NULL, header);
+}
+
+bool image_stream_write(image_stream *s, const uint8_t *rows, int count) {
+  if (s->failed || s->y + count > s->h)
     return false;
 
-  struct jpeg_compress_struct cinfo;
-  struct jpeg_error_mgr jerr;
-  cinfo.err = jpeg_std_error(&jerr);
-  jpeg_create_compress(&cinfo);
-  jpeg_stdio_dest(&cinfo, fp);
-
-  cinfo.image_width = w;
-  cinfo.image_height = h;
-  cinfo.input_components = 3;
-  cinfo.in_color_space = JCS_RGB;
-  jpeg_set_defaults(&cinfo);
-  jpeg_set_quality(&cinfo, 95, TRUE);
-  jpeg_start_compress(&cinfo, TRUE);
-
-  while (cinfo.next_scanline < cinfo.image_height) {
-    JSAMPROW row_pointer[1] = {image + cinfo.next_scanline * w * 3};
-    jpeg_write_scanlines(&cinfo, row_pointer, 1);
-  }
-
-  jpeg_finish_compress(&cinfo);
-  jpeg_destroy_compress(&cinfo);
-  fclose(fp);
+  bool ok = true;
+  switch (s->format) {
+  case IMAGE_PNG:
+    ok = png_writer_add_rows(s->png, rows, count);
+    break;
+  case IMAGE_JPEG:
+    for (int i = 0; i < count; ++i) {
+      JSAMPROW row_pointer[1] = {(JSAMPROW)rows + (size_t)i * s->w * 3};
+      jpeg_write_scanlines(&s->cinfo, row_pointer, 1);
+    }
+    break;
+  case IMAGE_QOI:
+    ok = qoi_write(s, rows, count);
+    break;
+  case IMAGE_GRID:
+    ok = grid_write(s, rows, count);
+    break;
+  default:
+    ok = raw_write(s, rows, (size_t)count * s->w * 3);
+  }
+  if (!ok) {
+    s->failed = true;
+    return false;
+  }
+  s->y += count;
   return true;
 }
+
+bool image_stream_close(image_stream *s) {
+  if (!s)
+    return false;
+
+  bool ok = !s->failed && s->y == s->h;
+  if (s->format == IMAGE_JPEG) {
+    if (ok)
+      jpeg_finish_compress(&s->cinfo);
+    if (s->cinfo.err)
+      jpeg_destroy_compress(&s->cinfo);
+  } else if (s->format == IMAGE_PNG && !png_writer_close(s->png)) {
+    ok = false;
+  }
+  if (fclose(s->fp) != 0)
+    ok = false;
+  free(s->qoi_out);
+  free(s->grid_rows);
+  free(s->grid_tiles);
+  free(s);
+  return ok;
+}
+
+static bool save_image(
+    const char *path, uint8_t *image, int w, int h, image_format format
+) {
+  image_stream *s = stream_open(path, w, h, format, NULL, NULL);
+  if (!s)
+    return false;
+  image_stream_write(s, image, h);
+  return image_stream_close(s);
+}
+
+bool save_image_png(const char *path, uint8_t *image, int w, int h) {
+  return save_image(path, image, w, h, IMAGE_PNG);
+}
+
+bool save_image_jpg(const char *path, uint8_t *image, int w, int h) {
+  return save_image(path, image, w, h, IMAGE_JPEG);
+}
@@ -0,0 +1,202 @@
+#include "keyframe_zoom.h"
+#include "common.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAPS_MAX (KEYFRAME_SCALE + 1) // A box of up to scale pixels
+
+// Source pixels of one output pixel along one axis
+typedef struct {
+  int first, count;
+  float weight[TAPS_MAX];
+} tap;
+
+int keyframe_zoom_count(double zoom, int per_octave) {
+  return (int)floor(fabs(log2(zoom)) * per_octave + 1e-9) + 1;
+}
+
+keyframe_zoom *keyframe_zoom_create(
+    int w, int h, double re_min, double re_max, double im_min, double im_max,
+    double zoom, int per_octave
+) {
+  if (per_octave < 1 || zoom <= 0)
+    return NULL;
+  keyframe_zoom *kz = safe_alloc(sizeof(keyframe_zoom));
+  *kz = (keyframe_zoom){
+      .w = w,
+      .h = h,
+      .per_octave = per_octave,
+      .count = keyframe_zoom_count(zoom, per_octave),
+      .level_max = zoom > 1 ? log2(zoom) : 0, // the widest view comes first
+      .re_center = 0.5 * (re_min + re_max),
+      .im_center = 0.5 * (im_min + im_max),
+      .re_span = re_max - re_min,
+      .im_span = im_max - im_min
+  };
+  kz->grids = safe_alloc(kz->count * sizeof(uint8_t *));
+  for (int k = 0; k < kz->count; ++k) {
+    kz->grids[k] = NULL;
+  }
+  return kz;
+}
+
+void keyframe_zoom_destroy(keyframe_zoom *kz) {
+  if (!kz)
+    return;
+  for (int k = 0; k < kz->count; ++k) {
+    free(kz->grids[k]);
+  }
+  free(kz->grids);
+  free(kz);
+}
+
+void keyframe_zoom_alloc(keyframe_zoom *kz, int k) {
+  if (!kz->grids[k]) {
+    kz->grids[k] =
+        safe_alloc((size_t)KEYFRAME_SCALE * kz->w * KEYFRAME_SCALE * kz->h);
+  }
+}
+
+void keyframe_zoom_free(keyframe_zoom *kz, int k) {
+  free(kz->grids[k]);
+  kz->grids[k] = NULL;
+}
+
+static double keyframe_level(const keyframe_zoom *kz, int k) {
+  return kz->level_max - (double)k / kz->per_octave;
+}
+
+void keyframe_zoom_bounds(
+    const keyframe_zoom *kz, int k, double *re_min, double *re_max,
+    double *im_min, double *im_max
+) {
+  double zoom = exp2(keyframe_level(kz, k));
+  *re_min = kz->re_center - 0.5 * kz->re_span * zoom;
+  *re_max = kz->re_center + 0.5 * kz->re_span * zoom;
+  *im_min = kz->im_center - 0.5 * kz->im_span * zoom;
+  *im_max = kz->im_center + 0.5 * kz->im_span * zoom;
+}
+
+// Box filter over [s0, s1) in source pixels, clamped to the n source pixels
+static void box_taps(double s0, double s1, int n, tap *t) {
+  s0 = s0 < 0 ? 0 : s0;
+  s1 = s1 > n ? n : s1;
+  t->first = s0 < n ? (int)s0 : n - 1;
+  t->count = 0;
+  if (s1 <= s0) {
+    t->weight[t->count++] = 1;
+    return;
+  }
+  for (int u = t->first; u < s1 && t->count < TAPS_MAX; ++u) {
+    double lo = u > s0 ? u : s0;
+    double hi = u + 1 < s1 ? u + 1 : s1;
+    t->weight[t->count++] = (hi - lo) / (s1 - s0);
+  }
+}
+
+// Taps of the n frame pixels along an axis, ratio source pixels per frame
+// pixel. Samples sit on the pixel corners (see render_row()), so each covers
+// the box around its sample point, and both views share their centre.
+static void axis_taps(int n, double ratio, tap *taps) {
+  double offset = 0.5 * (KEYFRAME_SCALE - ratio) * n + 0.5 * (1 - ratio);
+  for (int x = 0; x < n; ++x) {
+    box_taps(
+        offset + x * ratio, offset + (x + 1) * ratio, KEYFRAME_SCALE * n,
+        &taps[x]
+    );
+  }
+}
+
+// Adds weight times the coloured keyframe rows of ty, filtered along x, to acc
+static void accumulate_row(
+    const keyframe_zoom *kz, const uint8_t *grid, const tap *ty,
+    const tap *tx, float weight, const palette *pal, float *acc
+) {
+  size_t stride = (size_t)KEYFRAME_SCALE * kz->w;
+  for (int j = 0; j < ty->count; ++j) {
+    const uint8_t *src = grid + (ty->first + j) * stride;
+    float wy = weight * ty->weight[j];
+    for (int x = 0; x < kz->w; ++x) {
+      const tap *t = &tx[x];
+      float *dst = acc + 3 * x;
+      for (int i = 0; i < t->count; ++i) {
+	const uint8_t *rgb = pal->rgb[src[t->first + i]];
+	float wxy = wy * t->weight[i];
+	dst[0] += wxy * rgb[0];
+	dst[1] += wxy * rgb[1];
+	dst[2] += wxy * rgb[2];
+      }
+    }
+  }
+}
+
+// The nearest keyframe above level
+static int keyframe_at(const keyframe_zoom *kz, double level) {
+  int k = (int)floor((kz->level_max - level) * kz->per_octave + 1e-9);
+  return k < 0 ? 0 : k > kz->count - 1 ? kz->count - 1 : k;
+}
+
+// The nearest keyframe above level, right after it is reached the previous
+// one fades out, so the jump in sharpness between keyframes is not visible
+int keyframe_zoom_keys(
+    const keyframe_zoom *kz, double level, int *keys, float *weights
+) {
+  double pos = (kz->level_max - level) * kz->per_octave;
+  int k = keyframe_at(kz, level);
+  double fade = 1 - (pos - k) / KEYFRAME_FADE; // weight of keyframe k - 1
+  if (k == 0 || fade <= 0) {
+    keys[0] = k;
+    weights[0] = 1;
+    return 1;
+  }
+  if (fade >= 1) {
+    keys[0] = k - 1;
+    weights[0] = 1;
+    return 1;
+  }
+  keys[0] = k;
+  weights[0] = 1 - fade;
+  keys[1] = k - 1;
+  weights[1] = fade;
+  return 2;
+}
+
+// Renders the frame at the given level as RGB out of its keyframes
+void keyframe_zoom_frame(
+    const keyframe_zoom *kz, double level, const palette *pal, uint8_t *rgb
+) {
+  int keys[2];
+  float weights[2];
+  int nbr_keys = keyframe_zoom_keys(kz, level, keys, weights);
+
+  tap *tx[2], *ty[2];
+  for (int i = 0; i < nbr_keys; ++i) {
+    double ratio = KEYFRAME_SCALE * exp2(level - keyframe_level(kz, keys[i]));
+    tx[i] = safe_alloc(kz->w * sizeof(tap));
+    ty[i] = safe_alloc(kz->h * sizeof(tap));
+    axis_taps(kz->w, ratio, tx[i]);
+    axis_taps(kz->h, ratio, ty[i]);
+  }
+
+  float *acc = safe_alloc(3 * kz->w * sizeof(float));
+  for (int y = 0; y < kz->h; ++y) {
+    memset(acc, 0, 3 * kz->w * sizeof(float));
+    for (int i = 0; i < nbr_keys; ++i) {
+      accumulate_row(
+          kz, kz->grids[keys[i]], &ty[i][y], tx[i], weights[i], pal, acc
+      );
+    }
+    uint8_t *dst = rgb + (size_t)y * kz->w * 3;
+    for (int x = 0; x < 3 * kz->w; ++x) {
+      dst[x] = acc[x] < 255 ? (uint8_t)(acc[x] + 0.5f) : 255;
+    }
+  }
+
+  free(acc);
+  for (int i = 0; i < nbr_keys; ++i) {
+    free(tx[i]);
+    free(ty[i]);
+  }
+}
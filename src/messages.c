@@ -27,14 +27,14 @@ bool get_message_size(uint8_t msg_type, int *len) {
     *len = 2 + 3 * sizeof(uint8_t); // 2 + major, minor, patch
     break;
   case MSG_SET_COMPUTE:
-    *len = 2 + 4 * sizeof(double) + 1; // 2 + 4 * params + n
+    *len = 2 + 4 * sizeof(double) + 2; // 2 + 4 * params + n + gen
     break;
   case MSG_COMPUTE:
-    *len = 2 + 1 + 2 * sizeof(double) +
-           2; // 2 + cid (8bit) + 2x(double - re, im) + 2 ( n_re, n_im)
+    // 2 + cid (8bit) + 2x(double - re, im) + 2 (n_re, n_im) + gen
+    *len = 2 + 1 + 2 * sizeof(double) + 2 + 1;
     break;
   case MSG_COMPUTE_DATA:
-    *len = 2 + 4; // cid, dx, dy, iter
+    *len = 2 + 5; // cid, dx, dy, iter, gen
     break;
   default:
     ret = EXIT_ERROR;
@@ -89,7 +89,8 @@ bool fill_message_buf(const message *msg, uint8_t *buf, int size, int *len) {
         sizeof(double)
     );
     buf[1 + 4 * sizeof(double)] = msg->data.set_compute.n;
-    *len = 1 + 4 * sizeof(double) + 1;
+    buf[1 + 4 * sizeof(double) + 1] = msg->data.set_compute.gen;
+    *len = 1 + 4 * sizeof(double) + 2;
     break;
   case MSG_COMPUTE:
     buf[1] = msg->data.compute.cid; // cid
@@ -101,14 +102,16 @@ bool fill_message_buf(const message *msg, uint8_t *buf, int size, int *len) {
     );
     buf[2 + 2 * sizeof(double) + 0] = msg->data.compute.n_re;
     buf[2 + 2 * sizeof(double) + 1] = msg->data.compute.n_im;
-    *len = 1 + 1 + 2 * sizeof(double) + 2;
+    buf[2 + 2 * sizeof(double) + 2] = msg->data.compute.gen;
+    *len = 1 + 1 + 2 * sizeof(double) + 3;
     break;
   case MSG_COMPUTE_DATA:
     buf[1] = msg->data.compute_data.cid;
     buf[2] = msg->data.compute_data.i_re;
     buf[3] = msg->data.compute_data.i_im;
     buf[4] = msg->data.compute_data.iter;
-    *len = 5;
+    buf[5] = msg->data.compute_data.gen;
+    *len = 6;
     break;
   default: // unknown message type
     ret = EXIT_ERROR;
@@ -174,6 +177,7 @@ bool parse_message_buf(const uint8_t *buf, int size, message *msg) {
           sizeof(double)
       );
       msg->data.set_compute.n = buf[1 + 4 * sizeof(double)];
+      msg->data.set_compute.gen = buf[1 + 4 * sizeof(double) + 1];
       break;
     case MSG_COMPUTE: // type + chunk_id + nbr_tasks
       msg->data.compute.cid = buf[1];
@@ -187,12 +191,14 @@ bool parse_message_buf(const uint8_t *buf, int size, message *msg) {
       );
       msg->data.compute.n_re = buf[2 + 2 * sizeof(double) + 0];
       msg->data.compute.n_im = buf[2 + 2 * sizeof(double) + 1];
+      msg->data.compute.gen = buf[2 + 2 * sizeof(double) + 2];
       break;
-    case MSG_COMPUTE_DATA: // type + chunk_id + task_id + result
+    case MSG_COMPUTE_DATA: // type + chunk_id + task_id + result + gen
       msg->data.compute_data.cid = buf[1];
       msg->data.compute_data.i_re = buf[2];
       msg->data.compute_data.i_im = buf[3];
       msg->data.compute_data.iter = buf[4];
+      msg->data.compute_data.gen = buf[5];
       break;
     default: // unknown message type
       ret = false;
@@ -0,0 +1,186 @@
+#include "palette.h"
+
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+void palette_gradient_default(double t, uint8_t *rgb) {
+  rgb[0] = 9 * (1 - t) * t * t * t * 255;
+  rgb[1] = 15 * (1 - t) * (1 - t) * t * t * 255;
+  rgb[2] = 8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255;
+}
+
+static uint8_t clamp_unit(double v) {
+  return v <= 0 ? 0 : v >= 1 ? 255 : v * 255;
+}
+
+// Black through red and yellow to white near the boundary
+static void palette_gradient_fire(double t, uint8_t *rgb) {
+  double u = 4 * t * (1 - t);
+  rgb[0] = clamp_unit(3 * u);
+  rgb[1] = clamp_unit(3 * u - 1);
+  rgb[2] = clamp_unit(3 * u - 2);
+}
+
+static void palette_gradient_gray(double t, uint8_t *rgb) {
+  rgb[0] = rgb[1] = rgb[2] = clamp_unit(4 * t * (1 - t));
+}
+
+const palette_gradient_info palette_gradients[PALETTE_GRADIENTS] = {
+    {"default", palette_gradient_default},
+    {"fire", palette_gradient_fire},
+    {"gray", palette_gradient_gray}
+};
+
+// BT.601 limited range, the matrix swscale uses for RGB to YUV420P
+static void rgb_to_yuv(const uint8_t *rgb, uint8_t *yuv) {
+  double r = rgb[0], g = rgb[1], b = rgb[2];
+  yuv[0] = 16.5 + (65.481 * r + 128.553 * g + 24.966 * b) / 255;
+  yuv[1] = 128.5 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255;
+  yuv[2] = 128.5 + (112.0 * r - 93.786 * g - 18.214 * b) / 255;
+}
+
+// Entries past n + 1 are never looked up, they get the colour of t = 1 so
+// the gradients are only evaluated in [0, 1]
+static void palette_build(palette *p) {
+  for (int i = 0; i < PALETTE_SIZE; ++i) {
+    uint8_t *c = p->rgb[i];
+    p->gradient(i <= p->n + 1 ? i / (p->n + 1.0) : 1.0, c);
+    p->packed[i] = c[0] | (uint32_t)c[1] << 8 | (uint32_t)c[2] << 16;
+    rgb_to_yuv(c, p->yuv[i]);
+  }
+  p->version++;
+}
+
+void palette_init(palette *p, palette_gradient_fn gradient) {
+  memset(p, 0, sizeof(*p));
+  p->n = -1;
+  p->gradient = gradient ? gradient : palette_gradient_default;
+}
+
+// Rebuilds the table only when the iteration limit changed
+bool palette_update(palette *p, int n) {
+  if (p->n == n)
+    return false;
+  p->n = n;
+  palette_build(p);
+  return true;
+}
+
+void palette_set_gradient(palette *p, palette_gradient_fn gradient) {
+  p->gradient = gradient ? gradient : palette_gradient_default;
+  if (p->n >= 0)
+    palette_build(p);
+}
+
+void palette_apply(
+    const palette *p, const uint8_t *iters, size_t count, uint8_t *rgb
+) {
+  size_t i = 0;
+#ifdef __AVX2__
+  // 8 pixels per step: gather the packed entries, then drop every 4th byte.
+  // The second 16 byte store spills 4 bytes past the block, which the
+  // following pixels overwrite, hence the 2 pixel margin.
+  const __m256i drop_pad = _mm256_setr_epi8(
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5,
+      6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+  );
+  for (; i + 10 <= count; i += 8) {
+    __m128i idx8 = _mm_loadl_epi64((const __m128i *)(iters + i));
+    __m256i idx = _mm256_cvtepu8_epi32(idx8);
+    __m256i px = _mm256_i32gather_epi32((const int *)p->packed, idx, 4);
+    px = _mm256_shuffle_epi8(px, drop_pad);
+    _mm_storeu_si128((__m128i *)(rgb + i * 3), _mm256_castsi256_si128(px));
+    _mm_storeu_si128(
+        (__m128i *)(rgb + i * 3 + 12), _mm256_extracti128_si256(px, 1)
+    );
+  }
+#endif
+  for (; i < count; ++i) {
+    memcpy(rgb + i * 3, p->rgb[iters[i]], 3);
+  }
+}
+
+// Maps iterations through a PALETTE_SIZE table of 32-bit pixels, e.g. one
+// pre-packed in a window surface's native format
+void palette_apply_packed(
+    const uint32_t *lut, const uint8_t *iters, size_t count, uint32_t *dst
+) {
+  size_t i = 0;
+#ifdef __AVX2__
+  for (; i + 8 <= count; i += 8) {
+    __m128i idx8 = _mm_loadl_epi64((const __m128i *)(iters + i));
+    __m256i idx = _mm256_cvtepu8_epi32(idx8);
+    __m256i px = _mm256_i32gather_epi32((const int *)lut, idx, 4);
+    _mm256_storeu_si256((__m256i *)(dst + i), px);
+  }
+#endif
+  for (; i < count; ++i) {
+    dst[i] = lut[iters[i]];
+  }
+}
+
+// Colours grid straight into YUV420 planes through the YCbCr table, each
+// chroma sample averages a 2x2 block (edges repeat for odd sizes)
+void palette_apply_yuv420(
+    const palette *p, const uint8_t *grid, int w, int h,
+    uint8_t *const *planes, const int *linesize
+) {
+  for (int y = 0; y < h; ++y) {
+    const uint8_t *src = grid + (size_t)y * w;
+    uint8_t *luma = planes[0] + (size_t)y * linesize[0];
+    for (int x = 0; x < w; ++x) {
+      luma[x] = p->yuv[src[x]][0];
+    }
+  }
+
+  for (int y = 0; y < (h + 1) / 2; ++y) {
+    const uint8_t *row0 = grid + (size_t)2 * y * w;
+    const uint8_t *row1 = 2 * y + 1 < h ? row0 + w : row0;
+    uint8_t *cb = planes[1] + (size_t)y * linesize[1];
+    uint8_t *cr = planes[2] + (size_t)y * linesize[2];
+    for (int x = 0; x < (w + 1) / 2; ++x) {
+      int x0 = 2 * x;
+      int x1 = x0 + 1 < w ? x0 + 1 : x0;
+      const uint8_t *a = p->yuv[row0[x0]], *b = p->yuv[row0[x1]];
+      const uint8_t *c = p->yuv[row1[x0]], *d = p->yuv[row1[x1]];
+      cb[x] = (a[1] + b[1] + c[1] + d[1] + 2) / 4;
+      cr[x] = (a[2] + b[2] + c[2] + d[2] + 2) / 4;
+    }
+  }
+}
+
+// Same layout as palette_apply_yuv420() for an RGB image, with the matrix
+// of the palette's table
+void rgb_to_yuv420(
+    const uint8_t *rgb, int w, int h, uint8_t *const *planes,
+    const int *linesize
+) {
+  for (int y = 0; y < (h + 1) / 2; ++y) {
+    const uint8_t *row0 = rgb + (size_t)2 * y * w * 3;
+    const uint8_t *row1 = 2 * y + 1 < h ? row0 + (size_t)w * 3 : row0;
+    uint8_t *luma0 = planes[0] + (size_t)2 * y * linesize[0];
+    uint8_t *luma1 = 2 * y + 1 < h ? luma0 + linesize[0] : NULL;
+    uint8_t *cb = planes[1] + (size_t)y * linesize[1];
+    uint8_t *cr = planes[2] + (size_t)y * linesize[2];
+    for (int x = 0; x < (w + 1) / 2; ++x) {
+      int x0 = 2 * x;
+      int x1 = x0 + 1 < w ? x0 + 1 : x0;
+      uint8_t a[3], b[3], c[3], d[3];
+      rgb_to_yuv(row0 + x0 * 3, a);
+      rgb_to_yuv(row0 + x1 * 3, b);
+      rgb_to_yuv(row1 + x0 * 3, c);
+      rgb_to_yuv(row1 + x1 * 3, d);
+      luma0[x0] = a[0];
+      luma0[x1] = b[0];
+      if (luma1) {
+	luma1[x0] = c[0];
+	luma1[x1] = d[0];
+      }
+      cb[x] = (a[1] + b[1] + c[1] + d[1] + 2) / 4;
+      cr[x] = (a[2] + b[2] + c[2] + d[2] + 2) / 4;
+    }
+  }
+}
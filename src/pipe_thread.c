@@ -6,10 +6,17 @@
 #include <stdio.h>
 
 static event_pusher_fn event_pusher = NULL;
+static compute_data_fn data_handler = NULL;
+static void *data_handler_arg = NULL;
 static int input_pipe_fd = -1;
 
 void pipe_set_event_pusher(event_pusher_fn handler) { event_pusher = handler; }
 
+void pipe_set_compute_data_handler(compute_data_fn handler, void *arg) {
+  data_handler = handler;
+  data_handler_arg = arg;
+}
+
 void pipe_set_input_pipe_fd(int fd) { input_pipe_fd = fd; }
 
 void *pipe_thread(void *arg) {
@@ -38,14 +45,18 @@ void *pipe_thread(void *arg) {
       }
 
       if (len > 0 && i == len) {
-	message *msg = safe_alloc(sizeof(message));
-	if (parse_message_buf(msg_buf, len, msg)) {
+	message parsed;
+	if (!parse_message_buf(msg_buf, len, &parsed)) {
+	  error("cannot parse message type %d", msg_buf[0]);
+	} else if (parsed.type == MSG_COMPUTE_DATA && data_handler) {
+	  // Fast path: per-pixel data never goes through the event queue
+	  data_handler(data_handler_arg, &parsed.data.compute_data);
+	} else {
+	  message *msg = safe_alloc(sizeof(message));
+	  *msg = parsed;
 	  event ev = {.type = EV_PIPE, .data.msg = msg};
 	  // debug("pipe_thread received message");
 	  event_pusher(ev);
-	} else {
-	  error("cannot parse message type %d", msg_buf[0]);
-	  free(msg);
 	}
 	i = len = 0;
       }
@@ -0,0 +1,349 @@
+#include "png_writer.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static const uint8_t png_signature[8] = {137, 'P', 'N', 'G', 13, 10, 26, 10};
+
+static void put_be32(uint8_t *dst, uint32_t v) {
+  dst[0] = v >> 24;
+  dst[1] = v >> 16;
+  dst[2] = v >> 8;
+  dst[3] = v;
+}
+
+static bool
+write_chunk(FILE *fp, const char *type, const uint8_t *data, size_t len) {
+  uint8_t head[8], tail[4];
+  put_be32(head, len);
+  memcpy(head + 4, type, 4);
+  uLong crc = crc32(crc32(0, NULL, 0), head + 4, 4);
+  if (len)
+    crc = crc32(crc, data, len);
+  put_be32(tail, crc);
+  return fwrite(head, 1, 8, fp) == 8 &&
+         (len == 0 || fwrite(data, 1, len, fp) == len) &&
+         fwrite(tail, 1, 4, fp) == 4;
+}
+
+static uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+// Writes the filter type byte and the filtered row, up is the raw row above
+static void filter_row(
+    int type, const uint8_t *row, const uint8_t *up, size_t len, uint8_t *out
+) {
+  out[0] = type;
+  for (size_t i = 0; i < len; ++i) {
+    uint8_t left = i >= 3 ? row[i - 3] : 0; // 3 bytes per pixel
+    uint8_t up_left = i >= 3 ? up[i - 3] : 0;
+    switch (type) {
+    case 0:
+      out[i + 1] = row[i];
+      break;
+    case 1:
+      out[i + 1] = row[i] - left;
+      break;
+    case 2:
+      out[i + 1] = row[i] - up[i];
+      break;
+    case 3:
+      out[i + 1] = row[i] - ((left + up[i]) >> 1);
+      break;
+    default:
+      out[i + 1] = row[i] - paeth(left, up[i], up_left);
+    }
+  }
+}
+
+// libpng's heuristic, the filter whose bytes as signed values sum up lowest
+static void filter_row_adaptive(
+    const uint8_t *row, const uint8_t *up, size_t len, uint8_t *out,
+    uint8_t *scratch
+) {
+  unsigned long best = ~0UL;
+  for (int type = 0; type < 5; ++type) {
+    filter_row(type, row, up, len, scratch);
+    unsigned long sum = 0;
+    for (size_t i = 1; i <= len; ++i) {
+      sum += abs((int8_t)scratch[i]);
+    }
+    if (sum < best) {
+      best = sum;
+      memcpy(out, scratch, len + 1);
+    }
+  }
+}
+
+// Grows *buf to at least len bytes, its contents are lost
+static void reserve(uint8_t **buf, size_t *cap, size_t len) {
+  if (*cap < len) {
+    free(*buf);
+    *buf = safe_alloc(len);
+    *cap = len;
+  }
+}
+
+// Filters and deflates one group, runs on a worker without the lock
+static void deflate_group(const png_writer *pw, png_group *g) {
+  size_t stride = (size_t)3 * pw->w;
+  size_t len = g->nbr_rows * (stride + 1);
+  uint8_t *scratch =
+      pw->filter == PNG_ROW_FILTER_ADAPTIVE ? safe_alloc(stride + 1) : NULL;
+  int type = pw->filter - PNG_ROW_FILTER_NONE;
+  for (int r = 0; r < g->nbr_rows; ++r) {
+    const uint8_t *up = g->rows + r * stride;
+    uint8_t *out = g->filtered + r * (stride + 1);
+    if (scratch)
+      filter_row_adaptive(up + stride, up, stride, out, scratch);
+    else
+      filter_row(type, up + stride, up, stride, out);
+  }
+  free(scratch);
+  g->adler = adler32(adler32(0, NULL, 0), g->filtered, len);
+
+  z_stream z = {0};
+  int strategy =
+      pw->filter == PNG_ROW_FILTER_NONE ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+  g->failed =
+      deflateInit2(&z, pw->level, Z_DEFLATED, -15, 8, strategy) != Z_OK;
+  if (g->failed)
+    return;
+  reserve(&g->out, &g->out_cap, deflateBound(&z, len) + 16);
+  // the zlib header goes in front of the first group, its level bits are
+  // only a hint
+  size_t header = g->first ? 2 : 0;
+  g->out[0] = 0x78;
+  g->out[1] = 0x9c;
+  z.next_in = g->filtered;
+  z.avail_in = len;
+  z.next_out = g->out + header;
+  z.avail_out = g->out_cap - header;
+  int ret = deflate(&z, g->last ? Z_FINISH : Z_SYNC_FLUSH);
+  g->failed =
+      z.avail_in != 0 || (g->last ? ret != Z_STREAM_END : ret != Z_OK);
+  g->out_len = g->out_cap - z.avail_out;
+  deflateEnd(&z);
+}
+
+static void *png_worker(void *arg) {
+  png_pool *pool = arg;
+  pthread_mutex_lock(&pool->mtx);
+  while (!pool->quit) {
+    png_writer *pw = pool->pw;
+    if (!pw || pw->next_job == pw->nbr_queued) {
+      pthread_cond_wait(&pool->cond, &pool->mtx);
+      continue;
+    }
+    png_group *g = &pool->groups[pw->next_job++ % pool->depth];
+    pool->nbr_busy++;
+    pthread_mutex_unlock(&pool->mtx);
+    deflate_group(pw, g);
+    pthread_mutex_lock(&pool->mtx);
+    g->done = true;
+    pool->nbr_busy--;
+    pthread_cond_broadcast(&pool->cond);
+  }
+  pthread_mutex_unlock(&pool->mtx);
+  return NULL;
+}
+
+// Writes out the groups up to and including last, waiting for each in turn
+static void write_groups(png_writer *pw, int last) {
+  while (pw->next_write <= last) {
+    png_group *g = &pw->groups[pw->next_write % pw->depth];
+    pthread_mutex_lock(&pw->pool->mtx);
+    while (!g->done) {
+      pthread_cond_wait(&pw->pool->cond, &pw->pool->mtx);
+    }
+    pthread_mutex_unlock(&pw->pool->mtx);
+
+    size_t len = g->nbr_rows * ((size_t)3 * pw->w + 1);
+    if (g->failed || !write_chunk(pw->fp, "IDAT", g->out, g->out_len))
+      pw->failed = true;
+    pw->adler = adler32_combine(pw->adler, g->adler, len);
+    g->queued = g->done = false;
+    pw->next_write++;
+  }
+}
+
+png_pool *png_pool_create(int threads) {
+  if (threads <= 0) {
+    long nbr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = nbr_cpus < 1 ? 1 : nbr_cpus;
+  }
+  png_pool *pool = safe_alloc(sizeof(png_pool));
+  *pool = (png_pool){
+      .depth = PNG_GROUPS_PER_THREAD * threads, .nbr_threads = threads
+  };
+  pool->groups = safe_alloc(pool->depth * sizeof(png_group));
+  memset(pool->groups, 0, pool->depth * sizeof(png_group));
+  pool->threads = safe_alloc(threads * sizeof(pthread_t));
+  pthread_mutex_init(&pool->mtx, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  return pool;
+}
+
+// Starts the workers for the first writer, fails if none started
+static bool pool_start(png_pool *pool) {
+  while (pool->nbr_started < pool->nbr_threads) {
+    pthread_t *thread = &pool->threads[pool->nbr_started];
+    if (pthread_create(thread, NULL, png_worker, pool))
+      break;
+    pool->nbr_started++;
+  }
+  if (pool->nbr_started == 0)
+    error("Failed to start PNG threads");
+  return pool->nbr_started > 0;
+}
+
+void png_pool_destroy(png_pool *pool) {
+  if (!pool)
+    return;
+  pthread_mutex_lock(&pool->mtx);
+  pool->quit = true;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mtx);
+  for (int i = 0; i < pool->nbr_started; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  for (int i = 0; i < pool->depth; ++i) {
+    free(pool->groups[i].rows);
+    free(pool->groups[i].filtered);
+    free(pool->groups[i].out);
+  }
+  free(pool->groups);
+  free(pool->threads);
+  pthread_mutex_destroy(&pool->mtx);
+  pthread_cond_destroy(&pool->cond);
+  free(pool);
+}
+
+png_writer *png_writer_create(FILE *fp, int w, int h, const png_options *opt) {
+  png_options defaults = {.level = -1};
+  opt = opt ? opt : &defaults;
+  png_pool *pool = opt->pool ? opt->pool : png_pool_create(opt->threads);
+  png_writer *pw = safe_alloc(sizeof(png_writer));
+  *pw = (png_writer){
+      .fp = fp,
+      .w = w,
+      .h = h,
+      .level = opt->level >= 0 ? opt->level : PNG_LEVEL_DEFAULT,
+      .filter = opt->filter,
+      .depth = pool->depth,
+      .groups = pool->groups,
+      .adler = adler32(0, NULL, 0),
+      .pool = pool,
+      .own_pool = !opt->pool
+  };
+
+  // small images need no more than one group, the buffers of a shared pool
+  // only grow
+  size_t stride = (size_t)3 * w;
+  pw->group_rows = PNG_GROUP_BYTES / stride;
+  if (pw->group_rows > h)
+    pw->group_rows = h;
+  if (pw->group_rows < 1)
+    pw->group_rows = 1;
+  for (int i = 0; i < pw->depth; ++i) {
+    png_group *g = &pw->groups[i];
+    reserve(&g->rows, &g->rows_cap, (pw->group_rows + 1) * stride);
+    reserve(&g->filtered, &g->filtered_cap, pw->group_rows * (stride + 1));
+    g->queued = g->done = false; // left over by an incomplete file
+  }
+  memset(pw->groups[0].rows, 0, stride); // nothing above the first row
+
+  uint8_t ihdr[13] = {0};
+  put_be32(ihdr, w);
+  put_be32(ihdr + 4, h);
+  ihdr[8] = 8; // bits per sample
+  ihdr[9] = 2; // RGB, compression, filter and interlace methods stay 0
+  if (fwrite(png_signature, 1, 8, fp) != 8 ||
+      !write_chunk(fp, "IHDR", ihdr, sizeof(ihdr)))
+    pw->failed = true;
+
+  if (pool->nbr_started == 0 && !pool_start(pool)) {
+    png_writer_close(pw);
+    return NULL;
+  }
+  pthread_mutex_lock(&pool->mtx);
+  pool->pw = pw;
+  pthread_mutex_unlock(&pool->mtx);
+  return pw;
+}
+
+bool png_writer_add_rows(png_writer *pw, const uint8_t *rows, int count) {
+  size_t stride = (size_t)3 * pw->w;
+  if (pw->failed || pw->nbr_rows + count > pw->h)
+    return false;
+
+  for (int i = 0; i < count; ++i) {
+    png_group *g = &pw->groups[pw->next_fill % pw->depth];
+    if (pw->nbr_rows == pw->next_fill * pw->group_rows) {
+      // a new group, its slot may still hold the group depth back
+      if (g->queued)
+	write_groups(pw, pw->next_fill - pw->depth);
+      g->nbr_rows = 0;
+      g->first = pw->next_fill == 0;
+      if (!g->first) {
+	// the previous group is at most being deflated, its rows are intact
+	png_group *prev = &pw->groups[(pw->next_fill - 1) % pw->depth];
+	memcpy(g->rows, prev->rows + prev->nbr_rows * stride, stride);
+      }
+    }
+    memcpy(g->rows + (++g->nbr_rows) * stride, rows + i * stride, stride);
+    pw->nbr_rows++;
+
+    if (g->nbr_rows == pw->group_rows || pw->nbr_rows == pw->h) {
+      pthread_mutex_lock(&pw->pool->mtx);
+      g->last = pw->nbr_rows == pw->h;
+      g->queued = true;
+      pw->nbr_queued++;
+      pthread_cond_broadcast(&pw->pool->cond);
+      pthread_mutex_unlock(&pw->pool->mtx);
+      pw->next_fill++;
+    }
+  }
+  return !pw->failed;
+}
+
+bool png_writer_close(png_writer *pw) {
+  if (!pw)
+    return false;
+
+  bool complete = pw->nbr_rows == pw->h;
+  if (complete) {
+    write_groups(pw, pw->next_fill - 1);
+    uint8_t adler[4];
+    put_be32(adler, pw->adler);
+    if (!write_chunk(pw->fp, "IDAT", adler, 4) ||
+        !write_chunk(pw->fp, "IEND", NULL, 0))
+      pw->failed = true;
+  }
+
+  // groups no worker took yet are dropped, the pool is free once the
+  // others are done
+  png_pool *pool = pw->pool;
+  pthread_mutex_lock(&pool->mtx);
+  pw->nbr_queued = pw->next_job;
+  while (pool->nbr_busy > 0) {
+    pthread_cond_wait(&pool->cond, &pool->mtx);
+  }
+  pool->pw = NULL;
+  pthread_mutex_unlock(&pool->mtx);
+
+  bool ok = complete && !pw->failed;
+  if (pw->own_pool)
+    png_pool_destroy(pool);
+  free(pw);
+  return ok;
+}
@@ -1,17 +1,25 @@
 #include "computation.h"
+#include "compute_thread.h"
 #include "keyboard_thread.h"
 #include "pipe_thread.h"
 #include "prg_io_nonblock.h"
 #include "prgsem_main.h"
+#include "render_thread.h"
 #include "window_thread.h"
 
 #ifdef ENABLE_CLI
 #include "cli.h"
+#include "ffmpeg_writer.h"
+#include "frame_stream.h"
+#include "keyframe_zoom.h"
+#include "png_writer.h"
 #endif
 
 #include "version.h"
 
 #include <argp.h>
+#include <errno.h>
+#include <math.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
@@ -21,16 +29,23 @@
 
 const char *argp_program_version = APP_VERSION;
 
+#define JOB_ARGS_MAX 64 // Words on one line of a --jobs file
+
+// Reports an invalid option value, also stops a parse with ARGP_NO_EXIT
+#define arg_fail(state, ...) (argp_error(state, __VA_ARGS__), EINVAL)
+
+static char *program_name; // argv[0], also names job lines in errors
+
 static struct argp_option options[] = {
     {"pipe-in", 'i', "FILE", 0,
      "Input pipe path (default: /tmp/computational_module.out)"}, // path
     {"pipe-out", 'o', "FILE", 0,
      "Output pipe path (default: /tmp/computational_module.in)"}, // path
     {"width", 'w', "PX", 0, "Image width (default: 640)"
-    }, // > 50, < 10000 must be divisable by
+    }, // > 50, < 10000 (1000000 for --cli stills) must be divisable by
        // CHUNK_SIZE_FACTOR
     {"height", 'h', "PX", 0, "Image height (default: 480)"
-    }, // > 50, < 10000 must be divisable by
+    }, // > 50, < 10000 (1000000 for --cli stills) must be divisable by
        // CHUNK_SIZE_FACTOR
     {"c-re", 'r', "VAL", 0, "Real part of c (default: -0.4)"
     }, // up to size of int
@@ -43,11 +58,15 @@ static struct argp_option options[] = {
     },                             // up to size of int
     {"log-level", 'v', "LEVEL", 0, // 0-3
      "Set log verbosity (0=error, 1=warn, 2=info, 3=debug)"},
+    {"open", 1018, "FILE", 0,
+     "Show (or with --cli recolour) a .grid file instead of computing, its "
+     "view replaces the one given"},
 #ifdef ENABLE_CLI
     {"cli", 1003, 0, 0,
      "Enable non-graphical CLI mode allowing animation creation"},
     {"output", 1004, "FILE", 0,
-     "Output image file (.png or .jpg for images, .mp4 for videos)"},
+     "Output file (.png, .jpg, .ppm, .pam, .qoi, .rgb or .grid iterations for "
+     "images, .mp4, .mkv, ... for videos)"},
     {"anim-fps", 1005, "N", 0, "Number of frames per second in video"
     }, // only if cli, >0, <120
     {"anim-duration", 1007, "N", 0, "Duration of animation in seconds"
@@ -59,6 +78,42 @@ static struct argp_option options[] = {
                                                                         // > 0,
                                                                         // <=
                                                                         // 255
+    {"anim-in-flight", 1008, "N", 0,
+     "Frames rendered in parallel ahead of the encoder (default: CPUs + 2)"
+    }, // only if cli, >0, <=256
+    {"anim-keyframes", 1009, "Q", 0,
+     "Resample frames from Q supersampled keyframes per zoom doubling"
+    }, // only if cli, >=0, <=KEYFRAMES_PER_OCTAVE_MAX
+    {"video-codec", 1010, "NAME", 0,
+     "Video encoder, e.g. libx264 (default), libx265 or ffv1 (lossless)"},
+    {"video-preset", 1011, "NAME", 0,
+     "Encoder speed preset, e.g. ultrafast to veryslow for libx264"},
+    {"video-crf", 1012, "N", 0, "Constant rate factor (default: 18)"
+    }, // only if cli, >=0, <=51
+    {"video-threads", 1013, "N", 0, "Encoder threads (default: one per CPU)"
+    }, // only if cli, >=0, <=256
+    {"video-threading", 1014, "TYPE", 0,
+     "Encoder threading: frame, slice or both (default)"},
+    {"png-level", 1015, "N", 0, "PNG compression level 0-9 (default: 6)"
+    }, // only if cli, >=0, <=9
+    {"png-filter", 1016, "NAME", 0,
+     "PNG row filter: none, sub, up, average, paeth or adaptive (default)"},
+    {"anim-stream", 1017, "FORMAT", 0,
+     "Stream uncompressed y4m or rgb frames to the output (a file, FIFO or - "
+     "for stdout) instead of encoding, the default for - and .y4m"},
+    {"palette", 1019, "NAME", 0, "Colour palette: default, fire or gray"},
+    {"jobs", 1020, "FILE", 0,
+     "Render the stills listed in FILE, one line of options each (as printed "
+     "by the b key), --output is a %d pattern for lines without their own"},
+    {"frame-range", 1021, "START END", 0,
+     "Render only animation frames START to END - 1 into a segment, both on "
+     "whole seconds (multiples of the FPS)"},
+    {"concat", 1022, 0, 0,
+     "Join the segment files given as arguments into --output without "
+     "re-encoding"},
+    {"antialias", 1023, "PATTERN", 0,
+     "Supersample pixels on edges of iterations: rgss (4 samples), 2x2, 3x3, "
+     "4x4 or off (default)"},
 #endif
     {0}
 };
@@ -74,19 +129,21 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     break;
   case 'w':
     args->w = atoi(arg);
-    if (args->w < 50 || args->w > 10000 || args->w % CHUNK_SIZE_FACTOR != 0) {
-      argp_error(
-          state, "Invalid width (must be 50–10000 and divisible by %d)",
-          CHUNK_SIZE_FACTOR
+    if (args->w < IMAGE_SIZE_MIN || args->w > CLI_IMAGE_SIZE_MAX ||
+        args->w % CHUNK_SIZE_FACTOR != 0) {
+      return arg_fail(
+          state, "Invalid width (must be %d–%d and divisible by %d)",
+          IMAGE_SIZE_MIN, CLI_IMAGE_SIZE_MAX, CHUNK_SIZE_FACTOR
       );
     }
     break;
   case 'h':
     args->h = atoi(arg);
-    if (args->h < 50 || args->h > 10000 || args->h % CHUNK_SIZE_FACTOR != 0) {
-      argp_error(
-          state, "Invalid height (must be 50–10000 and divisible by %d)",
-          CHUNK_SIZE_FACTOR
+    if (args->h < IMAGE_SIZE_MIN || args->h > CLI_IMAGE_SIZE_MAX ||
+        args->h % CHUNK_SIZE_FACTOR != 0) {
+      return arg_fail(
+          state, "Invalid height (must be %d–%d and divisible by %d)",
+          IMAGE_SIZE_MIN, CLI_IMAGE_SIZE_MAX, CHUNK_SIZE_FACTOR
       );
     }
     break;
@@ -99,29 +156,32 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case 'n':
     args->n = atoi(arg);
     if (args->n <= 0 || args->n > 200) {
-      argp_error(state, "Invalid iteration count (must be 1–200)");
+      return arg_fail(state, "Invalid iteration count (must be 1–200)");
     }
     break;
   case 'v':
     args->log_level = atoi(arg);
     if (args->log_level < 0 || args->log_level > 3) {
-      argp_error(state, "Invalid log level (0–3 expected)");
+      return arg_fail(state, "Invalid log level (0–3 expected)");
     }
     break;
   case 1001: // --range-re
-    if (state->next + 1 >= state->argc) {
-      argp_error(state, "--range-re requires two values (MIN MAX)");
+    if (state->next >= state->argc) {
+      return arg_fail(state, "--range-re requires two values (MIN MAX)");
     }
     args->range_re_min = atof(arg);
     args->range_re_max = atof(state->argv[state->next++]);
     break;
   case 1002: // --range-im
-    if (state->next + 1 >= state->argc) {
-      argp_error(state, "--range-im requires two values (MIN MAX)");
+    if (state->next >= state->argc) {
+      return arg_fail(state, "--range-im requires two values (MIN MAX)");
     }
     args->range_im_min = atof(arg);
     args->range_im_max = atof(state->argv[state->next++]);
     break;
+  case 1018:
+    args->open_path = arg;
+    break;
 #ifdef ENABLE_CLI
   case 1003:
     args->cli_mode = true;
@@ -132,22 +192,163 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
   case 1005:
     args->anim_fps = atoi(arg);
     if (args->anim_fps <= 0 || args->anim_fps > 120) {
-      argp_error(state, "Invalid FPS (must be 1–120)");
+      return arg_fail(state, "Invalid FPS (must be 1–120)");
     }
     break;
   case 1006:
     args->anim_zoom_factor = atof(arg);
     if (args->anim_zoom_factor <= 0.0 || args->anim_zoom_factor > 255.0) {
-      argp_error(state, "Invalid zoom factor (must be > 0 and <= 255)");
+      return arg_fail(state, "Invalid zoom factor (must be > 0 and <= 255)");
     }
     break;
   case 1007:
     args->anim_duration = atoi(arg);
     if (args->anim_duration <= 0 || args->anim_duration > 36000) {
-      argp_error(state, "Invalid animation duration (must be 1–36000 seconds)");
+      return arg_fail(
+          state, "Invalid animation duration (must be 1–36000 seconds)"
+      );
+    }
+    break;
+  case 1008:
+    args->anim_in_flight = atoi(arg);
+    if (args->anim_in_flight <= 0 || args->anim_in_flight > 256) {
+      return arg_fail(
+          state, "Invalid number of frames in flight (must be 1–256)"
+      );
     }
     break;
+  case 1009:
+    args->anim_keyframes = atoi(arg);
+    if (args->anim_keyframes < 0 ||
+        args->anim_keyframes > KEYFRAMES_PER_OCTAVE_MAX) {
+      return arg_fail(
+          state, "Invalid keyframes per zoom doubling (must be 0–%d)",
+          KEYFRAMES_PER_OCTAVE_MAX
+      );
+    }
+    break;
+  case 1010:
+    args->video_codec = arg;
+    break;
+  case 1011:
+    args->video_preset = arg;
+    break;
+  case 1012:
+    args->video_crf = atoi(arg);
+    if (args->video_crf < 0 || args->video_crf > 51) {
+      return arg_fail(state, "Invalid CRF (must be 0–51)");
+    }
+    break;
+  case 1013:
+    args->video_threads = atoi(arg);
+    if (args->video_threads < 0 || args->video_threads > 256) {
+      return arg_fail(
+          state, "Invalid number of encoder threads (must be 0–256)"
+      );
+    }
+    break;
+  case 1014:
+    if (strcmp(arg, "frame") == 0) {
+      args->video_thread_type = FF_THREAD_FRAME;
+    } else if (strcmp(arg, "slice") == 0) {
+      args->video_thread_type = FF_THREAD_SLICE;
+    } else if (strcmp(arg, "both") == 0) {
+      args->video_thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    } else {
+      return arg_fail(
+          state, "Invalid threading (must be frame, slice or both)"
+      );
+    }
+    break;
+  case 1015:
+    args->png_level = atoi(arg);
+    if (args->png_level < 0 || args->png_level > 9) {
+      return arg_fail(state, "Invalid PNG level (must be 0–9)");
+    }
+    break;
+  case 1016: {
+    static const char *filters[] = {
+        [PNG_ROW_FILTER_ADAPTIVE] = "adaptive", [PNG_ROW_FILTER_NONE] = "none",
+        [PNG_ROW_FILTER_SUB] = "sub",           [PNG_ROW_FILTER_UP] = "up",
+        [PNG_ROW_FILTER_AVERAGE] = "average",   [PNG_ROW_FILTER_PAETH] = "paeth"
+    };
+    args->png_filter = -1;
+    for (int i = 0; i < (int)(sizeof(filters) / sizeof(*filters)); ++i) {
+      if (strcmp(arg, filters[i]) == 0)
+	args->png_filter = i;
+    }
+    if (args->png_filter < 0) {
+      return arg_fail(
+          state, "Invalid PNG filter (none, sub, up, average, paeth, adaptive)"
+      );
+    }
+    break;
+  }
+  case 1017:
+    if (strcmp(arg, "y4m") == 0) {
+      args->anim_stream = FRAME_STREAM_Y4M;
+    } else if (strcmp(arg, "rgb") == 0) {
+      args->anim_stream = FRAME_STREAM_RGB;
+    } else {
+      return arg_fail(state, "Invalid stream format (must be y4m or rgb)");
+    }
+    break;
+  case 1019:
+    args->palette = -1;
+    for (int i = 0; i < PALETTE_GRADIENTS; ++i) {
+      if (strcmp(arg, palette_gradients[i].name) == 0)
+	args->palette = i;
+    }
+    if (args->palette < 0) {
+      return arg_fail(state, "Invalid palette (must be default, fire or gray)");
+    }
+    break;
+  case 1020:
+    args->jobs_path = arg;
+    break;
+  case 1021: // --frame-range
+    if (state->next >= state->argc) {
+      return arg_fail(state, "--frame-range requires two values (START END)");
+    }
+    args->frame_start = atoi(arg);
+    args->frame_end = atoi(state->argv[state->next++]);
+    if (args->frame_start < 0 || args->frame_end <= args->frame_start) {
+      return arg_fail(state, "Invalid frame range (must be 0 <= START < END)");
+    }
+    break;
+  case 1022:
+    args->concat = true;
+    break;
+  case 1023:
+    args->antialias = -1;
+    for (int i = 0; i < AA_PATTERNS; ++i) {
+      if (strcmp(arg, aa_patterns[i].name) == 0)
+	args->antialias = i;
+    }
+    if (args->antialias < 0) {
+      return arg_fail(
+          state, "Invalid antialiasing (must be rgss, 2x2, 3x3, 4x4 or off)"
+      );
+    }
+    break;
+  case ARGP_KEY_ARGS: // the segments to --concat
+    if (!args->concat)
+      return ARGP_ERR_UNKNOWN;
+    args->segments = state->argv + state->next;
+    args->nbr_segments = state->argc - state->next;
+    break;
 #endif
+  case ARGP_KEY_END:
+    // only CLI stills, streamed in bands, can be larger than a window,
+    // animation frames are held whole and handed to the encoder
+    if ((!args->cli_mode || args->anim_duration > 0) &&
+        (args->w > IMAGE_SIZE_MAX || args->h > IMAGE_SIZE_MAX)) {
+      return arg_fail(
+          state, "Width and height above %d are only supported for CLI stills",
+          IMAGE_SIZE_MAX
+      );
+    }
+    break;
   default:
     return ARGP_ERR_UNKNOWN;
   }
@@ -156,6 +357,27 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 
 static struct argp argp = {options, parse_opt, NULL, APP_DOCSTRING};
 
+bool parse_args_line(char *line, struct arguments *args) {
+  char *argv[JOB_ARGS_MAX + 2] = {program_name};
+  int argc = 1;
+  char *save;
+  for (char *word = strtok_r(line, " \t\r\n", &save); word;
+       word = strtok_r(NULL, " \t\r\n", &save)) {
+    if (argc > JOB_ARGS_MAX) {
+      error("More than %d words on one line", JOB_ARGS_MAX);
+      return false;
+    }
+    argv[argc++] = word;
+  }
+  return argp_parse(
+             &argp, argc, argv, ARGP_NO_EXIT | ARGP_NO_HELP, NULL, args
+         ) == 0;
+}
+
+static void store_compute_data(void *arg, const msg_compute_data *data) {
+  update_data((comp_ctx *)arg, data);
+}
+
 bool apply_args_to_ctx(struct arguments *args, comp_ctx *ctx) {
   if (args->w <= 0 || args->h <= 0 || args->n <= 0) {
     error(
@@ -188,6 +410,37 @@ bool apply_args_to_ctx(struct arguments *args, comp_ctx *ctx) {
   return EXIT_OK;
 }
 
+// Maps the --open grid file and takes its view over into args, the window
+// (or an image) of that size then shows its iterations as they are
+static grid_file *open_grid(struct arguments *args) {
+  grid_file *g = grid_file_open(args->open_path);
+  if (!g)
+    return NULL;
+
+  const grid_file_header *h = &g->header;
+  unsigned max = args->cli_mode ? CLI_IMAGE_SIZE_MAX : IMAGE_SIZE_MAX;
+  if (h->w < IMAGE_SIZE_MIN || h->w > max || h->w % CHUNK_SIZE_FACTOR ||
+      h->h < IMAGE_SIZE_MIN || h->h > max || h->h % CHUNK_SIZE_FACTOR ||
+      h->n < 1) {
+    error(
+        "Cannot show a %ux%u grid (must be %d–%u and divisible by %d)", h->w,
+        h->h, IMAGE_SIZE_MIN, max, CHUNK_SIZE_FACTOR
+    );
+    grid_file_close(g);
+    return NULL;
+  }
+  args->w = h->w;
+  args->h = h->h;
+  args->n = h->n;
+  args->c_re = h->c_re;
+  args->c_im = h->c_im;
+  args->range_re_min = h->re_min;
+  args->range_re_max = h->re_max;
+  args->range_im_min = h->im_min;
+  args->range_im_max = h->im_max;
+  return g;
+}
+
 int main(int argc, char *argv[]) {
   signal(SIGPIPE, SIG_IGN); // ignore pipe errors, handle them in code
 
@@ -204,28 +457,35 @@ int main(int argc, char *argv[]) {
       .range_re_max = 1.6,
       .range_im_min = -1.1,
       .range_im_max = 1.1,
-      .log_level = LOG_LEVEL_INFO
+      .log_level = LOG_LEVEL_INFO,
+      .video_crf = -1,
+      .png_level = -1
   };
 
   app_state state = {
-      .image = NULL,
       .computing_lock = false,
       .ctx = NULL,
       .fd_in = -1,
       .fd_out = -1
   };
 
-  static pthread_t th_keyboard = 0, th_pipe = 0, th_sdl = 0;
+  static pthread_t th_keyboard = 0, th_pipe = 0, th_sdl = 0, th_render = 0,
+                   th_compute = 0;
   bool xwin_initialized = false;
 
+  program_name = argv[0];
   argp_parse(&argp, argc, argv, 0, 0, &args);
   set_log_level(args.log_level);
 
+  if (args.open_path && !(state.opened = open_grid(&args)))
+    return EXIT_FAILURE;
+
 #ifdef ENABLE_CLI
   // CLI-only mode
   if (args.cli_mode) {
     int ret = cli_main(&state, &args);
     // handles cleaning independently
+    grid_file_close(state.opened);
     return ret;
   }
 #endif
@@ -250,6 +510,7 @@ int main(int argc, char *argv[]) {
   xwin_set_event_pusher(queue_push);
   keyboard_set_event_pusher(queue_push);
   pipe_set_event_pusher(queue_push);
+  pipe_set_compute_data_handler(store_compute_data, state.ctx);
   pipe_set_input_pipe_fd(state.fd_in);
 
   if (!apply_args_to_ctx(&args, state.ctx)) {
@@ -269,6 +530,14 @@ int main(int argc, char *argv[]) {
   xwin_initialized = true;
 
   set_image_size(&state, x, y);
+  if (state.opened) {
+    // no thread touches the grid yet
+    grid_file_read(state.opened, get_internal_grid(state.ctx));
+    set_grid_known(state.ctx);
+    grid_file_close(state.opened);
+    state.opened = NULL;
+    info("Showing %s, v switches the palette", args.open_path);
+  }
 
   if (pthread_create(&th_pipe, NULL, pipe_thread, NULL) != 0) {
     error("Failed to start pipe thread");
@@ -284,7 +553,9 @@ int main(int argc, char *argv[]) {
   safe_show_helpscreen(&state);
 
   if (pthread_create(&th_keyboard, NULL, keyboard_thread, NULL) != 0 ||
-      pthread_create(&th_sdl, NULL, window_thread, NULL) != 0) {
+      pthread_create(&th_sdl, NULL, window_thread, NULL) != 0 ||
+      pthread_create(&th_render, NULL, render_thread, state.ctx) != 0 ||
+      pthread_create(&th_compute, NULL, compute_thread, state.ctx) != 0) {
     error("Failed to start threads");
     set_quit();
     goto cleanup;
@@ -304,12 +575,16 @@ cleanup:
     pthread_join(th_keyboard, NULL);
   if (th_sdl)
     pthread_join(th_sdl, NULL);
+  if (th_render)
+    pthread_join(th_render, NULL);
+  if (th_compute)
+    pthread_join(th_compute, NULL);
   if (th_pipe)
     pthread_join(th_pipe, NULL);
 
+  grid_file_close(state.opened);
   if (xwin_initialized)
     xwin_close();
-  free(state.image);
   computation_destroy(state.ctx);
   if (state.fd_in != -1)
     io_close(state.fd_in);
@@ -379,15 +654,22 @@ bool module_handshake(app_state *state) {
 bool module_handshake(app_state *state) { return EXIT_OK; }
 #endif // ENABLE_HANDSHAKE
 
+// Both sizes span the same view and B is exactly twice A, so the samples
+// computed at one resolution are reused at the other
 void toggle_image_size(app_state *state) {
   int w = state->ctx->grid_w;
   int h = state->ctx->grid_h;
 
   if (w == WIDTH_A && h == HEIGHT_A) {
-    set_image_size(state, WIDTH_B, HEIGHT_B);
+    rescale_grid(state->ctx, WIDTH_B, HEIGHT_B, 1, 2, 0, 0);
+    xwin_resize(WIDTH_B, HEIGHT_B);
+  } else if (w == WIDTH_B && h == HEIGHT_B) {
+    rescale_grid(state->ctx, WIDTH_A, HEIGHT_A, 2, 1, 0, 0);
+    xwin_resize(WIDTH_A, HEIGHT_A);
   } else {
     set_image_size(state, WIDTH_A, HEIGHT_A);
   }
+  update_and_redraw(state);
   safe_show_helpscreen(state);
 }
 
@@ -404,17 +686,10 @@ void process_event(app_state *state, event *ev) {
       send_command(state, MSG_GET_VERSION);
       break;
     case 's':
-      if (state->computing_lock) {
-	warning("New computation parameters requested but it is "
-	        "discarded due to ongoing computation");
-	xwin_set_overlay_message("Cannot set parameters - computing!");
-	update_and_redraw(state);
-      } else {
-	info("Set new computation parameters");
-	xwin_set_overlay_message("Set new params");
-	toggle_image_size(state);
-	send_command(state, MSG_SET_COMPUTE);
-      }
+      info("Set new computation parameters");
+      xwin_set_overlay_message("Set new params");
+      toggle_image_size(state);
+      send_command(state, MSG_SET_COMPUTE);
       break;
     case '1':
       if (state->computing_lock) {
@@ -425,6 +700,11 @@ void process_event(app_state *state, event *ev) {
 	info("Starting full image computation");
 	xwin_set_overlay_message("Computation started");
 	send_command(state, MSG_COMPUTE);
+	if (is_done(state->ctx)) {
+	  info("Nothing to compute, whole image is known");
+	  xwin_set_overlay_message("Computation ended.");
+	  state->computing_lock = false;
+	}
       }
       break;
     case 'a':
@@ -450,17 +730,14 @@ void process_event(app_state *state, event *ev) {
 	update_and_redraw(state);
       }
       break;
-    case 'l': {
-      int w, h;
-      get_grid_size(state->ctx, &w, &h);
-      memset(state->image, 0, w * h * 3);
+    case 'l':
       clear_grid(state->ctx);
       xwin_set_overlay_message("Cleared");
       info("Display buffer cleared");
       update_and_redraw(state);
       break;
-    }
     case 'p':
+      mark_grid_dirty(state->ctx);
       xwin_set_overlay_message("Redrawed");
       update_and_redraw(state);
       info("Image refreshed");
@@ -505,6 +782,10 @@ void process_event(app_state *state, event *ev) {
     case 'b':
       print_params(state);
       break;
+    case 'v':
+      render_request_recolour();
+      xwin_set_overlay_message("Palette switched");
+      break;
     default:
       warning("Unknown keyboard event received: %c", ev->data.param);
     }
@@ -531,15 +812,10 @@ void process_event(app_state *state, event *ev) {
       send_command(state, MSG_SET_COMPUTE);
       break;
     }
-    case MSG_COMPUTE_DATA: {
-      if (state->computing_lock) {
-	debug("Received new computed data from module");
-	update_data(state->ctx, &msg->data.compute_data);
-      } else {
-	debug("Received computed data from module, but not computing");
-      }
+    case MSG_COMPUTE_DATA:
+      // Normally consumed on the pipe thread, see store_compute_data()
+      update_data(state->ctx, &msg->data.compute_data);
       break;
-    }
     case MSG_DONE:
       if (!state->computing_lock) {
 	warning("MSG_DONE received, but not computing");
@@ -548,14 +824,17 @@ void process_event(app_state *state, event *ev) {
       }
       debug("Module reports done computing chunk");
       update_and_redraw(state);
+      if (!is_done(state->ctx)) {
+	// If the view changed while the chunk was in flight, ctx_update()
+	// rewound the chunks and this starts the new view from its first one
+	debug("Not done yet, computing next chunk");
+	send_command(state, MSG_COMPUTE); // may find every chunk known
+      }
       if (is_done(state->ctx)) {
 	info("Computation ended");
 	xwin_set_overlay_message("Computation ended.");
 	update_and_redraw(state);
 	state->computing_lock = false;
-      } else {
-	debug("Not done yet, computing next chunk");
-	send_command(state, MSG_COMPUTE);
       }
       break;
     case MSG_ABORT:
@@ -596,6 +875,8 @@ void send_command(app_state *state, message_type cmd) {
     break;
   case MSG_COMPUTE:
     valid = compute(state->ctx, &msg);
+    if (!valid && is_done(state->ctx))
+      return; // no chunk left that is not known already
     break;
   default:
     return;
@@ -653,13 +934,6 @@ void print_params(app_state *state) {
 }
 
 void zoom_view(app_state *state, double factor) {
-  if (state->computing_lock) {
-    warning("Zoom discarded - computation in progress");
-    xwin_set_overlay_message("Not zooming - computing!");
-    update_and_redraw(state);
-    return;
-  }
-
   double re_center =
       0.5 * (state->ctx->range_re_min + state->ctx->range_re_max);
   double im_center =
@@ -669,11 +943,21 @@ void zoom_view(app_state *state, double factor) {
   double im_span =
       (state->ctx->range_im_max - state->ctx->range_im_min) * factor * 0.5;
 
-  state->ctx->range_re_min = re_center - re_span;
-  state->ctx->range_re_max = re_center + re_span;
-  state->ctx->range_im_min = im_center - im_span;
-  state->ctx->range_im_max = im_center + im_span;
-  clear_grid(state->ctx);
+  set_view(
+      state->ctx, re_center - re_span, re_center + re_span, im_center - im_span,
+      im_center + im_span
+  );
+
+  // a centred 2x zoom keeps every other pixel (in) or a quarter (out)
+  int w = state->ctx->grid_w;
+  int h = state->ctx->grid_h;
+  if (factor == 0.5 && w % 4 == 0 && h % 4 == 0) {
+    rescale_grid(state->ctx, w, h, 1, 2, w / 4, h / 4);
+  } else if (factor == 2 && w % 2 == 0 && h % 2 == 0) {
+    rescale_grid(state->ctx, w, h, 2, 1, -w / 2, -h / 2);
+  } else {
+    clear_grid(state->ctx);
+  }
   ctx_update(state->ctx);
   send_command(state, MSG_SET_COMPUTE);
   local_compute(state);
@@ -681,24 +965,23 @@ void zoom_view(app_state *state, double factor) {
   update_and_redraw(state);
 }
 
+// Pans by dx/dy of the view span, snapped to whole pixels so that the
+// overlapping part of the grid is reused and only the exposed strips are
+// computed (locally and by the module).
 void move_view(app_state *state, double dx, double dy) {
-  if (state->computing_lock) {
-    warning("Not moving - computing");
-    xwin_set_overlay_message("Not moving - computing");
-    update_and_redraw(state);
-    return;
-  }
-
-  double re_span = state->ctx->range_re_max - state->ctx->range_re_min;
-  double im_span = state->ctx->range_im_max - state->ctx->range_im_min;
-
-  state->ctx->range_re_min += dx * re_span;
-  state->ctx->range_re_max += dx * re_span;
-  state->ctx->range_im_min += dy * im_span;
-  state->ctx->range_im_max += dy * im_span;
+  comp_ctx *ctx = state->ctx;
+  int px = (int)lround(dx * ctx->grid_w);
+  int py = (int)lround(dy * ctx->grid_h);
+  double d_re = (ctx->range_re_max - ctx->range_re_min) / ctx->grid_w;
+  double d_im = (ctx->range_im_max - ctx->range_im_min) / ctx->grid_h;
+
+  set_view(
+      ctx, ctx->range_re_min + px * d_re, ctx->range_re_max + px * d_re,
+      ctx->range_im_min + py * d_im, ctx->range_im_max + py * d_im
+  );
 
-  clear_grid(state->ctx);
-  ctx_update(state->ctx);
+  shift_grid(ctx, px, -py); // grid rows go from im_max down
+  ctx_update(ctx);
   send_command(state, MSG_SET_COMPUTE);
   local_compute(state);
   xwin_set_overlay_message("Moved view");
@@ -706,13 +989,6 @@ void move_view(app_state *state, double dx, double dy) {
 }
 
 void change_iterations(app_state *state, int delta) {
-  if (state->computing_lock) {
-    warning("Not changing iterations - computing");
-    xwin_set_overlay_message("Not changing n - computing");
-    update_and_redraw(state);
-    return;
-  }
-
   int new_n = state->ctx->n + delta;
   if (new_n < 1 || new_n > 255) {
     warning("Iteration count out of bounds: %d", new_n);
@@ -721,86 +997,34 @@ void change_iterations(app_state *state, int delta) {
     return;
   }
 
-  state->ctx->n = new_n;
-  clear_grid(state->ctx);
+  // escaped pixels stay valid, only those that reached the old n change
+  set_iterations(state->ctx, new_n);
+  ctx_update(state->ctx);
+  send_command(state, MSG_SET_COMPUTE);
   local_compute(state);
   xwin_set_overlay_message("New n=%d", new_n);
   update_and_redraw(state);
-  ctx_update(state->ctx);
-  send_command(state, MSG_SET_COMPUTE);
 }
 
-void update_and_redraw(app_state *state) {
-  int w, h;
-  get_grid_size(state->ctx, &w, &h);
-  update_image(state->ctx, w, h, state->image);
-  xwin_redraw(w, h, state->image);
-}
+// Marks the frame dirty, the render thread redraws it on its next frame
+void update_and_redraw(app_state *state) { render_request_redraw(); }
 
 void set_image_size(app_state *state, int w, int h) {
-  state->ctx->grid_w = w;
-  state->ctx->grid_h = h;
-  state->ctx->chunk_n_re = w / CHUNK_SIZE_FACTOR;
-  state->ctx->chunk_n_im = h / CHUNK_SIZE_FACTOR;
-  ctx_update(state->ctx);
-
-  uint8_t *new_image = realloc(state->image, w * h * 3);
-  if (!new_image) {
-    error("Failed to reallocate image buffer");
-    set_quit();
-    return;
-  }
-  state->image = new_image;
+  set_grid_size(state->ctx, w, h);
 
   xwin_resize(w, h);
-  memset(state->image, 0, w * h * 3);
   clear_grid(state->ctx);
   update_and_redraw(state);
 }
 
-void safe_show_helpscreen(app_state *state) {
-  int w, h;
-  get_grid_size(state->ctx, &w, &h);
-  if (show_helpscreen(w, h)) {
-    info("Help screen showed");
-  } else {
-    error("Error showing help scren, window too small");
-  }
-}
+void safe_show_helpscreen(app_state *state) { render_request_helpscreen(); }
 
 uint8_t compute_pixel(
     double c_re, double c_im, double z_re, double z_im, uint8_t max_iter
 ) {
-  uint8_t k = 0;
-  while (k < max_iter && z_re * z_re + z_im * z_im < 4.0) {
-    double tmp = z_re * z_re - z_im * z_im + c_re;
-    z_im = 2 * z_re * z_im + c_im;
-    z_re = tmp;
-    k++;
-  }
-  return k;
+  orbit_z z = {.re = z_re, .im = z_im};
+  return iterate_orbit(c_re, c_im, &z, 0, max_iter);
 }
 
-void local_compute(app_state *state) {
-  info("Local computation on PC started");
-  xwin_set_overlay_message("Locally computed");
-  int w, h;
-  get_grid_size(state->ctx, &w, &h);
-  uint8_t *grid = get_internal_grid(state->ctx);
-
-  for (int y = 0; y < h; ++y) {
-    for (int x = 0; x < w; ++x) {
-      double z_re =
-          state->ctx->range_re_min +
-          x * ((state->ctx->range_re_max - state->ctx->range_re_min) / w);
-      double z_im =
-          state->ctx->range_im_max +
-          y * ((state->ctx->range_im_min - state->ctx->range_im_max) / h);
-      grid[y * w + x] = compute_pixel(
-          state->ctx->c_re, state->ctx->c_im, z_re, z_im, state->ctx->n
-      );
-    }
-  }
-
-  info("Local computation done");
-}
+// Hands the view to the compute thread, the event loop does not wait for it
+void local_compute(app_state *state) { compute_request_local(); }
@@ -222,9 +222,11 @@ void process_event(module_state *state, event *ev) {
       state->d_re = msg->data.set_compute.d_re;
       state->d_im = msg->data.set_compute.d_im;
       state->max_iter = msg->data.set_compute.n;
+      state->gen = msg->data.set_compute.gen;
       debug(
-          "Params set: c = %.3f + %.3fi, d = %.5f, %.5f, n = %d", state->c_re,
-          state->c_im, state->d_re, state->d_im, state->max_iter
+          "Params set: c = %.3f + %.3fi, d = %.5f, %.5f, n = %d, gen = %d",
+          state->c_re, state->c_im, state->d_re, state->d_im, state->max_iter,
+          state->gen
       );
       send_command(state, MSG_OK);
       break;
@@ -238,10 +240,13 @@ void process_event(module_state *state, event *ev) {
 	send_command(state, MSG_ERROR);
 	break;
       }
-      compute_chunk_and_send(
-          state, msg->data.compute.cid, msg->data.compute.re,
-          msg->data.compute.im, msg->data.compute.n_re, msg->data.compute.n_im
-      );
+      if (msg->data.compute.gen != state->gen) {
+	debug(
+	    "Chunk of generation %d computed with parameters of %d",
+	    msg->data.compute.gen, state->gen
+	);
+      }
+      compute_chunk_and_send(state, &msg->data.compute);
       send_command(state, MSG_DONE);
       break;
     default:
@@ -277,20 +282,25 @@ uint8_t compute_pixel(
   return k;
 }
 
-void compute_chunk_and_send(
-    module_state *state, uint8_t cid, double re0, double im0, uint8_t n_re,
-    uint8_t n_im
-) {
-  for (uint8_t y = 0; y < n_im; ++y) {
-    for (uint8_t x = 0; x < n_re; ++x) {
-      double z_re = re0 + x * state->d_re;
-      double z_im = im0 + y * state->d_im;
+// Results carry the generation of the chunk request so that the main
+// application can drop chunks of a view it has already left
+void compute_chunk_and_send(module_state *state, const msg_compute *chunk) {
+  for (uint8_t y = 0; y < chunk->n_im; ++y) {
+    for (uint8_t x = 0; x < chunk->n_re; ++x) {
+      double z_re = chunk->re + x * state->d_re;
+      double z_im = chunk->im + y * state->d_im;
       uint8_t iter =
           compute_pixel(state->c_re, state->c_im, z_re, z_im, state->max_iter);
 
       message data_msg = {
           .type = MSG_COMPUTE_DATA,
-          .data.compute_data = {.cid = cid, .i_re = x, .i_im = y, .iter = iter}
+          .data.compute_data = {
+              .cid = chunk->cid,
+              .i_re = x,
+              .i_im = y,
+              .iter = iter,
+              .gen = chunk->gen
+          }
       };
       send_message(state, &data_msg);
     }
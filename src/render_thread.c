@@ -0,0 +1,136 @@
+#include "render_thread.h"
+#include "computation.h"
+#include "window_thread.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+static pthread_mutex_t render_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t render_cond = PTHREAD_COND_INITIALIZER;
+static bool redraw_pending = false;
+static bool helpscreen_pending = false;
+static int recolour_pending = 0; // Gradients to step forward
+
+void render_request_redraw(void) {
+  pthread_mutex_lock(&render_mtx);
+  redraw_pending = true;
+  helpscreen_pending = false;
+  pthread_cond_signal(&render_cond);
+  pthread_mutex_unlock(&render_mtx);
+}
+
+// Switches to the next built-in gradient, which recolours the current grid
+void render_request_recolour(void) {
+  pthread_mutex_lock(&render_mtx);
+  recolour_pending++;
+  redraw_pending = true;
+  helpscreen_pending = false;
+  pthread_cond_signal(&render_cond);
+  pthread_mutex_unlock(&render_mtx);
+}
+
+void render_request_helpscreen(void) {
+  pthread_mutex_lock(&render_mtx);
+  redraw_pending = false;
+  helpscreen_pending = true;
+  pthread_cond_signal(&render_cond);
+  pthread_mutex_unlock(&render_mtx);
+}
+
+static void timespec_add_ns(struct timespec *ts, long ns) {
+  ts->tv_nsec += ns;
+  while (ts->tv_nsec >= 1000000000L) {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000L;
+  }
+}
+
+static bool
+timespec_before(const struct timespec *a, const struct timespec *b) {
+  return a->tv_sec < b->tv_sec ||
+         (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+// Waits until a redraw or the help screen is requested, returns false on quit
+static bool wait_for_request(bool *helpscreen, int *recolour) {
+  pthread_mutex_lock(&render_mtx);
+  while (!redraw_pending && !helpscreen_pending && !is_quit()) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    timespec_add_ns(&ts, RENDER_WAIT_TIMEOUT_MS * 1000000L);
+    pthread_cond_timedwait(&render_cond, &render_mtx, &ts);
+  }
+  *helpscreen = helpscreen_pending;
+  *recolour = recolour_pending;
+  redraw_pending = helpscreen_pending = false;
+  recolour_pending = 0;
+  pthread_mutex_unlock(&render_mtx);
+  return !is_quit();
+}
+
+// Redraws at most once per display refresh. Compute keeps writing the back
+// buffer (ctx->grid) while the frame is coloured from a private front copy.
+void *render_thread(void *arg) {
+  comp_ctx *ctx = arg;
+  uint8_t *front = NULL;
+  size_t front_size = 0;
+  bool helpscreen;
+  int recolour, gradient = 0;
+  palette pal;
+  palette_init(&pal, NULL);
+
+  int fps = xwin_refresh_rate();
+  long frame_ns = 1000000000L / (fps > 0 ? fps : RENDER_DEFAULT_FPS);
+  debug("render_thread - start (%d fps)", fps);
+
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  while (wait_for_request(&helpscreen, &recolour)) {
+    int w, h, n;
+    if (recolour) {
+      gradient = (gradient + recolour) % PALETTE_GRADIENTS;
+      palette_set_gradient(&pal, palette_gradients[gradient].fn);
+      info("Palette %s", palette_gradients[gradient].name);
+    }
+    if (helpscreen) {
+      get_grid_size(ctx, &w, &h);
+      if (show_helpscreen(w, h)) {
+	info("Help screen showed");
+      } else {
+	error("Error showing help scren, window too small");
+      }
+    } else {
+      grid_rect rects[DIRTY_RECTS_MAX];
+      int nbr_rects =
+          snapshot_grid(ctx, &front, &front_size, &w, &h, &n, rects);
+      palette_update(&pal, n); // window redraws fully on a new palette
+
+      if (nbr_rects < 0) {
+	xwin_redraw(w, h, front, &pal);
+      } else {
+	SDL_Rect sdl_rects[DIRTY_RECTS_MAX];
+	for (int i = 0; i < nbr_rects; ++i) {
+	  sdl_rects[i] = (SDL_Rect){
+	      .x = rects[i].x, .y = rects[i].y, .w = rects[i].w, .h = rects[i].h
+	  };
+	}
+	xwin_redraw_rects(w, h, front, &pal, sdl_rects, nbr_rects);
+      }
+    }
+
+    // Frame pacing, requests arriving meanwhile collapse into one redraw
+    struct timespec now;
+    timespec_add_ns(&next, frame_ns);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_before(&next, &now)) {
+      next = now;
+    } else {
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+  }
+
+  free(front);
+  debug("render_thread - stop");
+  return NULL;
+}
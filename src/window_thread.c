@@ -9,13 +9,27 @@
 #include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
+typedef struct {
+  char text[OVERLAY_MSG_MAXLEN];
+  SDL_Color color;
+  SDL_Surface *surf; // NULL when nothing is cached
+} text_cache;
+
 static SDL_Window *win = NULL;
 static TTF_Font *font = NULL;
 static event_pusher_fn event_push = NULL;
 static pthread_mutex_t xwin_mutex = PTHREAD_MUTEX_INITIALIZER;
 static char overlay_message[OVERLAY_MSG_MAXLEN] = "";
+static SDL_Rect overlay_rect = {0}; // Where the overlay message was last drawn
+static bool full_redraw_needed = true; // Surface no longer matches the grid
+static Uint32 native_lut[PALETTE_SIZE]; // Palette in the surface pixel format
+static unsigned native_lut_version = 0;
+static Uint32 native_lut_format = 0;
+static text_cache overlay_cache = {0};
+static SDL_Surface *helpscreen = NULL; // Whole help screen, window sized
 
 const char *showhelp_lines[] = {
     "HELP SCREEN",
@@ -29,6 +43,7 @@ const char *showhelp_lines[] = {
     "c - compute locally",
     "i/o - zoom in/out",
     "j/k - add/subtract n",
+    "v - switch palette",
     "arrows - move view",
     "h - show this help"
 };
@@ -71,12 +86,38 @@ int xwin_resize(int w, int h) {
   pthread_mutex_lock(&xwin_mutex);
   assert(win != NULL);
   SDL_SetWindowSize(win, w, h);
+  full_redraw_needed = true;
   pthread_mutex_unlock(&xwin_mutex);
   return EXIT_OK;
 }
 
+// Caller holds xwin_mutex
+static void text_cache_clear(text_cache *cache) {
+  SDL_FreeSurface(cache->surf);
+  *cache = (text_cache){0};
+}
+
+// Caller holds xwin_mutex. Renders text only when the string or colour
+// differs from the cached one.
+static SDL_Surface *
+text_cache_get(text_cache *cache, const char *text, SDL_Color color) {
+  if (cache->surf && strcmp(cache->text, text) == 0 &&
+      memcmp(&cache->color, &color, sizeof(color)) == 0)
+    return cache->surf;
+  text_cache_clear(cache);
+  cache->surf = TTF_RenderUTF8_Blended(font, text, color);
+  if (cache->surf) {
+    snprintf(cache->text, sizeof(cache->text), "%s", text);
+    cache->color = color;
+  }
+  return cache->surf;
+}
+
 void xwin_close(void) {
   pthread_mutex_lock(&xwin_mutex);
+  text_cache_clear(&overlay_cache);
+  SDL_FreeSurface(helpscreen);
+  helpscreen = NULL;
   if (font) {
     TTF_CloseFont(font);
     font = NULL;
@@ -89,8 +130,61 @@ void xwin_close(void) {
   pthread_mutex_unlock(&xwin_mutex);
 }
 
-void xwin_redraw(int w, int h, unsigned char *img) {
-  assert(img);
+// Caller holds xwin_mutex
+static void update_native_lut(const SDL_Surface *scr, const palette *pal) {
+  if (pal->version == native_lut_version &&
+      scr->format->format == native_lut_format)
+    return;
+  for (int i = 0; i < PALETTE_SIZE; ++i) {
+    native_lut[i] = SDL_MapRGB(
+        scr->format, pal->rgb[i][0], pal->rgb[i][1], pal->rgb[i][2]
+    );
+  }
+  native_lut_version = pal->version;
+  native_lut_format = scr->format->format;
+  full_redraw_needed = true;
+}
+
+// Writes rectangle r of the iteration grid (as wide as the surface) straight
+// into the surface pixels through the native palette table
+static void
+blit_grid_rect(SDL_Surface *scr, const uint8_t *grid, const SDL_Rect *r) {
+  const SDL_PixelFormat *fmt = scr->format;
+  for (int y = r->y; y < r->y + r->h; ++y) {
+    const uint8_t *src = grid + (size_t)y * scr->w + r->x;
+    Uint8 *row =
+        (Uint8 *)scr->pixels + y * scr->pitch + r->x * fmt->BytesPerPixel;
+    switch (fmt->BytesPerPixel) {
+    case 4:
+      palette_apply_packed(native_lut, src, r->w, (uint32_t *)row);
+      break;
+    case 2:
+      for (int x = 0; x < r->w; ++x)
+	((Uint16 *)row)[x] = native_lut[src[x]];
+      break;
+    default:
+      for (int x = 0; x < r->w; ++x, row += fmt->BytesPerPixel) {
+	Uint32 px = native_lut[src[x]];
+	*(row + fmt->Rshift / 8) = px >> fmt->Rshift;
+	*(row + fmt->Gshift / 8) = px >> fmt->Gshift;
+	*(row + fmt->Bshift / 8) = px >> fmt->Bshift;
+      }
+      break;
+    }
+  }
+}
+
+void xwin_redraw(int w, int h, const uint8_t *grid, const palette *pal) {
+  xwin_redraw_rects(w, h, grid, pal, NULL, -1);
+}
+
+// Redraws only the given rectangles (plus the overlay message), or the whole
+// window when nbr_rects < 0 or the surface was drawn over since last time
+void xwin_redraw_rects(
+    int w, int h, const uint8_t *grid, const palette *pal,
+    const SDL_Rect *rects, int nbr_rects
+) {
+  assert(grid && pal);
   pthread_mutex_lock(&xwin_mutex);
   if (!win) {
     pthread_mutex_unlock(&xwin_mutex);
@@ -98,25 +192,49 @@ void xwin_redraw(int w, int h, unsigned char *img) {
   }
 
   SDL_Surface *scr = SDL_GetWindowSurface(win);
-  if (!scr) {
+  if (!scr || scr->w != w || scr->h != h) {
+    // stale frame from before a resize, the next redraw will match
     pthread_mutex_unlock(&xwin_mutex);
     return;
   }
-
-  for (int y = 0; y < scr->h; ++y) {
-    for (int x = 0; x < scr->w; ++x) {
-      const int idx = (y * scr->w + x) * scr->format->BytesPerPixel;
-      Uint8 *px = (Uint8 *)scr->pixels + idx;
-      *(px + scr->format->Rshift / 8) = *(img++);
-      *(px + scr->format->Gshift / 8) = *(img++);
-      *(px + scr->format->Bshift / 8) = *(img++);
+  update_native_lut(scr, pal);
+
+  if (nbr_rects < 0 || full_redraw_needed) {
+    SDL_Rect all = {.x = 0, .y = 0, .w = scr->w, .h = scr->h};
+    blit_grid_rect(scr, grid, &all);
+    xwin_draw_overlay_message(scr);
+    full_redraw_needed = false;
+    SDL_UpdateWindowSurface(win);
+  } else {
+    SDL_Rect update[nbr_rects + 1];
+    for (int i = 0; i < nbr_rects; ++i) {
+      blit_grid_rect(scr, grid, &rects[i]);
+      update[i] = rects[i];
     }
+    int nbr_update = nbr_rects;
+    if (overlay_rect.w > 0 && overlay_rect.h > 0) {
+      // restore what is under the text first, blending is not idempotent
+      blit_grid_rect(scr, grid, &overlay_rect);
+      xwin_draw_overlay_message(scr);
+      update[nbr_update++] = overlay_rect;
+    }
+    if (nbr_update > 0)
+      SDL_UpdateWindowSurfaceRects(win, update, nbr_update);
   }
 
-  xwin_draw_overlay_message(scr);
+  pthread_mutex_unlock(&xwin_mutex);
+}
 
-  SDL_UpdateWindowSurface(win);
+int xwin_refresh_rate(void) {
+  SDL_DisplayMode mode;
+  int rate = 0;
+  pthread_mutex_lock(&xwin_mutex);
+  if (win &&
+      SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(win), &mode) == 0) {
+    rate = mode.refresh_rate;
+  }
   pthread_mutex_unlock(&xwin_mutex);
+  return rate;
 }
 
 void xwin_set_event_pusher(event_pusher_fn handler) { event_push = handler; }
@@ -127,35 +245,21 @@ int is_valid_sdl_key(SDL_Keycode key) {
          (key >= RIGHT && key <= FRONT);
 }
 
-void render_pixel(uint8_t iter, uint8_t *rgb) {
-  if (iter == 60) {
-    rgb[0] = rgb[1] = rgb[2] = 0;
-  } else {
-    double t = (double)iter / 60.0;
-    rgb[0] = (uint8_t)(9 * (1 - t) * t * t * t * 255);
-    rgb[1] = (uint8_t)(15 * (1 - t) * (1 - t) * t * t * 255);
-    rgb[2] = (uint8_t)(8.5 * (1 - t) * (1 - t) * (1 - t) * t * 255);
-  }
-}
-
-bool show_helpscreen(int w, int h) {
-  if (w < HELPSCREEN_W_MIN || h < HELPSCREEN_H_MIN || !font) {
-    return EXIT_ERROR;
-  }
-
-  pthread_mutex_lock(&xwin_mutex);
-  if (!win) {
-    pthread_mutex_unlock(&xwin_mutex);
-    return EXIT_ERROR;
-  }
-
-  SDL_Surface *surf = SDL_GetWindowSurface(win);
-  if (!surf) {
-    pthread_mutex_unlock(&xwin_mutex);
-    return EXIT_ERROR;
-  }
+// Caller holds xwin_mutex. Renders the help screen into a surface of the
+// window format, this happens only when the window size changed.
+static SDL_Surface *
+prerender_helpscreen(const SDL_Surface *scr, int w, int h) {
+  if (helpscreen && helpscreen->w == w && helpscreen->h == h &&
+      helpscreen->format->format == scr->format->format)
+    return helpscreen;
+  SDL_FreeSurface(helpscreen);
+  helpscreen = SDL_CreateRGBSurfaceWithFormat(
+      0, w, h, scr->format->BitsPerPixel, scr->format->format
+  );
+  if (!helpscreen)
+    return NULL;
 
-  SDL_FillRect(surf, NULL, SDL_MapRGB(surf->format, 255, 255, 255));
+  SDL_FillRect(helpscreen, NULL, SDL_MapRGB(helpscreen->format, 255, 255, 255));
 
   SDL_Color textColor = {0, 0, 0};
   int y = 30;
@@ -170,22 +274,57 @@ bool show_helpscreen(int w, int h) {
         .x = (w - text->w) / 2, .y = y, .w = text->w, .h = text->h
     };
 
-    SDL_BlitSurface(text, NULL, surf, &dest);
+    SDL_BlitSurface(text, NULL, helpscreen, &dest);
     SDL_FreeSurface(text);
     y += FONT_SIZE + 6;
   }
+  return helpscreen;
+}
 
+bool show_helpscreen(int w, int h) {
+  if (w < HELPSCREEN_W_MIN || h < HELPSCREEN_H_MIN || !font) {
+    return EXIT_ERROR;
+  }
+
+  pthread_mutex_lock(&xwin_mutex);
+  if (!win) {
+    pthread_mutex_unlock(&xwin_mutex);
+    return EXIT_ERROR;
+  }
+
+  SDL_Surface *surf = SDL_GetWindowSurface(win);
+  SDL_Surface *help = surf ? prerender_helpscreen(surf, w, h) : NULL;
+  if (!help) {
+    pthread_mutex_unlock(&xwin_mutex);
+    return EXIT_ERROR;
+  }
+
+  SDL_BlitSurface(help, NULL, surf, NULL);
   SDL_UpdateWindowSurface(win);
+  full_redraw_needed = true;
   pthread_mutex_unlock(&xwin_mutex);
   return EXIT_OK;
 }
 
+static SDL_Rect clip_to_surface(const SDL_Surface *surf, SDL_Rect r) {
+  int x1 = r.x + r.w, y1 = r.y + r.h;
+  r.x = r.x < 0 ? 0 : r.x;
+  r.y = r.y < 0 ? 0 : r.y;
+  r.w = (x1 > surf->w ? surf->w : x1) - r.x;
+  r.h = (y1 > surf->h ? surf->h : y1) - r.y;
+  if (r.w < 0 || r.h < 0)
+    r.w = r.h = 0;
+  return r;
+}
+
 void xwin_draw_overlay_message(SDL_Surface *surf) {
+  overlay_rect = (SDL_Rect){0};
   if (!overlay_message[0] || !font)
     return;
 
   SDL_Color textColor = {255, 255, 255};
-  SDL_Surface *text = TTF_RenderUTF8_Blended(font, overlay_message, textColor);
+  SDL_Surface *text =
+      text_cache_get(&overlay_cache, overlay_message, textColor);
   if (!text)
     return;
 
@@ -193,20 +332,24 @@ void xwin_draw_overlay_message(SDL_Surface *surf) {
       .x = surf->w - text->w - 10, .y = 10, .w = text->w, .h = text->h
   };
 
+  overlay_rect = clip_to_surface(surf, dest);
   SDL_BlitSurface(text, NULL, surf, &dest);
-  SDL_FreeSurface(text);
 }
 
 void xwin_set_overlay_message(const char *fmt, ...) {
   pthread_mutex_lock(&xwin_mutex);
 
+  char message[OVERLAY_MSG_MAXLEN] = "";
   if (fmt && *fmt) {
     va_list args;
     va_start(args, fmt);
-    vsnprintf(overlay_message, OVERLAY_MSG_MAXLEN, fmt, args);
+    vsnprintf(message, OVERLAY_MSG_MAXLEN, fmt, args);
     va_end(args);
-  } else {
-    overlay_message[0] = '\0';
+  }
+  if (strcmp(message, overlay_message) != 0) {
+    strcpy(overlay_message, message);
+    text_cache_clear(&overlay_cache);
+    full_redraw_needed = true; // old text may stick out of the new one
   }
 
   pthread_mutex_unlock(&xwin_mutex);